@@ -0,0 +1,96 @@
+#include "arena.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Bump-pointer allocator for objects that all die together. Allocation
+ * is a pointer increment inside the current chunk; a new chunk is taken
+ * when it runs out, and arena_free releases everything at once. A
+ * non-zero limit caps the bytes reserved from malloc; going over it
+ * longjmps to recover when that is set and exits otherwise.
+ *
+ * arena_use installs an arena for the calling thread, after which
+ * arena_malloc (and so every AST and list allocation) is served from it.
+ */
+
+#define ARENA_ALIGN (sizeof(void *))
+
+static __thread Arena *current;
+
+Arena *
+new_arena(size_t chunksize, size_t limit)
+{
+	Arena *arena = STATS_MALLOC(STATS_ARENA, sizeof *arena);
+	arena->chunk = NULL;
+	arena->chunksize = chunksize;
+	arena->limit = limit;
+	arena->bytes = 0;
+	arena->reserved = 0;
+	arena->chunks = 0;
+	arena->recover = NULL;
+	return arena;
+}
+
+void *
+arena_alloc(Arena *arena, size_t size)
+{
+	ArenaChunk *c = arena->chunk;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (c == NULL || c->size - c->used < size) {
+		size_t chunksize = size > arena->chunksize ? size : arena->chunksize;
+		if (arena->limit && arena->reserved + chunksize > arena->limit) {
+			if (arena->recover) {
+				longjmp(*arena->recover, 1);
+			}
+			fprintf(stderr, "arena limit of %zu bytes exceeded\n", arena->limit);
+			exit(1);
+		}
+		c = STATS_MALLOC(STATS_ARENA, sizeof *c + chunksize);
+		c->next = arena->chunk;
+		c->size = chunksize;
+		c->used = 0;
+		arena->chunk = c;
+		arena->reserved += chunksize;
+		arena->chunks++;
+	}
+	void *p = c->data + c->used;
+	c->used += size;
+	arena->bytes += size;
+	return p;
+}
+
+char *
+arena_strndup(Arena *arena, const char *s, size_t len)
+{
+	char *p = arena_alloc(arena, len + 1);
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+void
+arena_free(Arena *arena)
+{
+	ArenaChunk *c, *next;
+	for (c = arena->chunk; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(arena);
+}
+
+Arena *
+arena_use(Arena *arena)
+{
+	Arena *prev = current;
+	current = arena;
+	return prev;
+}
+
+void *
+arena_malloc(size_t size)
+{
+	return current ? arena_alloc(current, size) : malloc(size);
+}
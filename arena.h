@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+#include <setjmp.h>
+#include <stddef.h>
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size, used;
+	char data[];
+} ArenaChunk;
+typedef struct {
+	ArenaChunk *chunk;
+	size_t chunksize, limit;
+	size_t bytes, reserved;
+	int chunks;
+	jmp_buf *recover;
+} Arena;
+Arena *new_arena(size_t chunksize, size_t limit);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+void arena_free(Arena *arena);
+Arena *arena_use(Arena *arena);
+void *arena_malloc(size_t size);
+#endif
@@ -1,20 +1,205 @@
 #include "ast.h"
 #include "list.h"
+#include "stats.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Hash-consing. While an AstCons table is installed with ast_cons_use,
+ * the expression constructors look for a structurally identical node
+ * before allocating and return it instead. Children are built first and
+ * are already unique, so comparing them by pointer compares the whole
+ * subtree. Calls are never shared because they carry their source
+ * position, array literals because they own their element list, and
+ * statements because passes rewrite them.
+ */
+
+static __thread AstCons *cons;
 
 Node *
 new_node(AstType type, const void *value)
 {
-	Node *node = malloc(sizeof *node);
+	Node *node = STATS_ALLOC(STATS_AST, sizeof *node);
 	node->type = type;
 	node->value = value;
+	STATS_NODE(type);
+	return node;
+}
+
+AstCons *
+new_ast_cons(void)
+{
+	AstCons *c = malloc(sizeof *c);
+	c->cap = 1024;
+	c->len = 0;
+	c->entries = calloc(c->cap, sizeof *c->entries);
+	return c;
+}
+
+AstCons *
+ast_cons_use(AstCons *c)
+{
+	AstCons *prev = cons;
+	cons = c;
+	return prev;
+}
+
+void
+ast_cons_free(AstCons *c)
+{
+	free(c->entries);
+	free(c);
+}
+
+static size_t
+ast_hash_string(size_t h, const char *s)
+{
+	for (; *s; s++) {
+		h = (h ^ (unsigned char)*s) * 1099511628211UL;
+	}
+	return h;
+}
+
+static size_t
+ast_hash_node(size_t h, const Node *node)
+{
+	return (h ^ ((uintptr_t)node >> 3)) * 1099511628211UL;
+}
+
+static size_t
+ast_hash(AstType type, const void *value)
+{
+	size_t h = (14695981039346656037UL ^ type) * 1099511628211UL;
+	switch (type) {
+	case AST_BOOLEAN_EXPRESSION: {
+		const BooleanExpression *be = value;
+		return ast_hash_node(ast_hash_string(ast_hash_node(h, be->left), be->operator), be->right);
+	}
+	case AST_LOGICAL_OPERAND: {
+		const LogicalOperand *lo = value;
+		return ast_hash_node(ast_hash_string(ast_hash_node(h, lo->left), lo->operator), lo->right);
+	}
+	case AST_TERM: {
+		const Term *t = value;
+		return ast_hash_node(ast_hash_string(ast_hash_node(h, t->left), t->operator), t->right);
+	}
+	case AST_INDEX_EXPRESSION: {
+		const IndexExpression *ie = value;
+		return ast_hash_node(ast_hash_node(h, ie->array), ie->index);
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return ast_hash_node(h, ((const LogicalNotExpression *)value)->booleanExpression);
+	case AST_BOOLEAN_LITERAL:
+		return (h ^ ((const BooleanLiteral *)value)->value) * 1099511628211UL;
+	case AST_IDENTIFIER:
+		return ast_hash_string(h, ((const Identifier *)value)->value);
+	case AST_NUMBER_LITERAL:
+		return ast_hash_string(h, ((const NumberLiteral *)value)->value);
+	case AST_STRING_LITERAL:
+		return ast_hash_string(h, ((const StringLiteral *)value)->value);
+	default:
+		return h;
+	}
+}
+
+static int
+ast_equal(AstType type, const void *a, const void *b)
+{
+	switch (type) {
+	case AST_BOOLEAN_EXPRESSION: {
+		const BooleanExpression *x = a, *y = b;
+		return x->left == y->left && x->right == y->right && !strcmp(x->operator, y->operator);
+	}
+	case AST_LOGICAL_OPERAND: {
+		const LogicalOperand *x = a, *y = b;
+		return x->left == y->left && x->right == y->right && !strcmp(x->operator, y->operator);
+	}
+	case AST_TERM: {
+		const Term *x = a, *y = b;
+		return x->left == y->left && x->right == y->right && !strcmp(x->operator, y->operator);
+	}
+	case AST_INDEX_EXPRESSION: {
+		const IndexExpression *x = a, *y = b;
+		return x->array == y->array && x->index == y->index;
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return ((const LogicalNotExpression *)a)->booleanExpression ==
+		    ((const LogicalNotExpression *)b)->booleanExpression;
+	case AST_BOOLEAN_LITERAL:
+		return ((const BooleanLiteral *)a)->value == ((const BooleanLiteral *)b)->value;
+	case AST_IDENTIFIER:
+		return !strcmp(((const Identifier *)a)->value, ((const Identifier *)b)->value);
+	case AST_NUMBER_LITERAL:
+		return !strcmp(((const NumberLiteral *)a)->value, ((const NumberLiteral *)b)->value);
+	case AST_STRING_LITERAL:
+		return !strcmp(((const StringLiteral *)a)->value, ((const StringLiteral *)b)->value);
+	default:
+		return 0;
+	}
+}
+
+static Node **
+ast_cons_slot(AstType type, const void *value)
+{
+	size_t mask = cons->cap - 1;
+	size_t i = ast_hash(type, value) & mask;
+	while (cons->entries[i]) {
+		Node *n = cons->entries[i];
+		if (n->type == type && ast_equal(type, n->value, value)) {
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return &cons->entries[i];
+}
+
+static Node *
+ast_cons_find(AstType type, const void *value)
+{
+	if (cons == NULL) {
+		return NULL;
+	}
+	Node *node = *ast_cons_slot(type, value);
+	STATS_CONS(node != NULL);
 	return node;
 }
 
+static Node *
+ast_cons_add(Node *node)
+{
+	if (cons == NULL) {
+		return node;
+	}
+	if (cons->len * 2 >= cons->cap) {
+		Node **old = cons->entries;
+		size_t oldcap = cons->cap, i;
+		cons->cap *= 2;
+		cons->entries = calloc(cons->cap, sizeof *cons->entries);
+		for (i = 0; i < oldcap; i++) {
+			if (old[i]) {
+				*ast_cons_slot(old[i]->type, old[i]->value) = old[i];
+			}
+		}
+		free(old);
+	}
+	*ast_cons_slot(node->type, node->value) = node;
+	cons->len++;
+	return node;
+}
+
+Node *
+new_array_literal(List *elements)
+{
+	ArrayLiteral *al = STATS_ALLOC(STATS_AST, sizeof *al);
+	al->elements = elements;
+	return new_node(AST_ARRAY_LITERAL, al);
+}
+
 Node *
 new_assignment_statement(const char *id, Node *expression)
 {
-	AssignmentStatement *as = malloc(sizeof *as);
+	AssignmentStatement *as = STATS_ALLOC(STATS_AST, sizeof *as);
 	as->id = id;
 	as->expression = expression;
 	return new_node(AST_ASSIGNMENT_STATEMENT, as);
@@ -23,7 +208,7 @@ new_assignment_statement(const char *id, Node *expression)
 Node *
 new_block(List *statements)
 {
-	Block *b = malloc(sizeof *b);
+	Block *b = STATS_ALLOC(STATS_AST, sizeof *b);
 	b->statements = statements;
 	return new_node(AST_BLOCK, b);
 }
@@ -31,48 +216,57 @@ new_block(List *statements)
 Node *
 new_boolean_expression(Node *left, const char *operator, Node *right)
 {
-	BooleanExpression *be = malloc(sizeof *be);
-	be->left = left;
-	be->operator = operator;
-	be->right = right;
-	return new_node(AST_BOOLEAN_EXPRESSION, be);
+	BooleanExpression key = {.left = left, .operator = operator, .right = right};
+	Node *node = ast_cons_find(AST_BOOLEAN_EXPRESSION, &key);
+	if (node != NULL) {
+		return node;
+	}
+	BooleanExpression *be = STATS_ALLOC(STATS_AST, sizeof *be);
+	*be = key;
+	return ast_cons_add(new_node(AST_BOOLEAN_EXPRESSION, be));
 }
 
 Node *
 new_boolean_literal(int value)
 {
-	BooleanLiteral *bl = malloc(sizeof *bl);
-	bl->value = value;
-	return new_node(AST_BOOLEAN_LITERAL, bl);
+	BooleanLiteral key = {.value = value};
+	Node *node = ast_cons_find(AST_BOOLEAN_LITERAL, &key);
+	if (node != NULL) {
+		return node;
+	}
+	BooleanLiteral *bl = STATS_ALLOC(STATS_AST, sizeof *bl);
+	*bl = key;
+	return ast_cons_add(new_node(AST_BOOLEAN_LITERAL, bl));
 }
 
 Node *
 new_break_statement(void)
 {
-	BreakStatement *bs = malloc(sizeof *bs);
+	BreakStatement *bs = STATS_ALLOC(STATS_AST, sizeof *bs);
 	return new_node(AST_BREAK_STATEMENT, bs);
 }
 
 Node *
-new_call_expression(const char *name, List *arguments)
+new_call_expression(const char *name, List *arguments, uint32_t offset)
 {
-	CallExpression *ce = malloc(sizeof *ce);
+	CallExpression *ce = STATS_ALLOC(STATS_AST, sizeof *ce);
 	ce->name = name;
 	ce->arguments = arguments;
+	ce->offset = offset;
 	return new_node(AST_CALL_EXPRESSION, ce);
 }
 
 Node *
 new_continue_statement(void)
 {
-	ContinueStatement *cs = malloc(sizeof *cs);
+	ContinueStatement *cs = STATS_ALLOC(STATS_AST, sizeof *cs);
 	return new_node(AST_CONTINUE_STATEMENT, cs);
 }
 
 Node *
 new_declaration_statement(const char *id, Node *expression)
 {
-	DeclarationStatement *ds = malloc(sizeof *ds);
+	DeclarationStatement *ds = STATS_ALLOC(STATS_AST, sizeof *ds);
 	ds->id = id;
 	ds->expression = expression;
 	return new_node(AST_DECLARATION_STATEMENT, ds);
@@ -84,62 +278,104 @@ new_declaration_statement(const char *id, Node *expression)
 // }
 
 Node *
-new_function_statement(const char *name, List *parameters, Node *block)
+new_function_statement(const char *name, List *parameters, Node *block, uint32_t offset)
 {
-	FunctionStatement *fs = malloc(sizeof *fs);
+	FunctionStatement *fs = STATS_ALLOC(STATS_AST, sizeof *fs);
 	fs->name = name;
 	fs->parameters = parameters;
 	fs->block = block;
+	fs->pure = 0;
+	fs->integer = 0;
+	fs->offset = offset;
+	fs->body = fs->end = fs->depth = 0;
 	return new_node(AST_FUNCTION_STATEMENT, fs);
 }
 
 Node *
 new_identifier(const char *value)
 {
-	Identifier *i = malloc(sizeof *i);
-	i->value = value;
-	return new_node(AST_IDENTIFIER, i);
+	Identifier key = {.value = value};
+	Node *node = ast_cons_find(AST_IDENTIFIER, &key);
+	if (node != NULL) {
+		return node;
+	}
+	Identifier *i = STATS_ALLOC(STATS_AST, sizeof *i);
+	*i = key;
+	return ast_cons_add(new_node(AST_IDENTIFIER, i));
 }
 
 Node *
 new_if_statement(Node *booleanExpression, Node *block)
 {
-	IfStatement *is = malloc(sizeof *is);
+	IfStatement *is = STATS_ALLOC(STATS_AST, sizeof *is);
 	is->booleanExpression = booleanExpression;
 	is->block = block;
 	return new_node(AST_IF_STATEMENT, is);
 }
 
+Node *
+new_index_expression(Node *array, Node *index)
+{
+	IndexExpression key = {.array = array, .index = index};
+	Node *node = ast_cons_find(AST_INDEX_EXPRESSION, &key);
+	if (node != NULL) {
+		return node;
+	}
+	IndexExpression *ie = STATS_ALLOC(STATS_AST, sizeof *ie);
+	*ie = key;
+	return ast_cons_add(new_node(AST_INDEX_EXPRESSION, ie));
+}
+
+Node *
+new_join_statement(void)
+{
+	JoinStatement *js = STATS_ALLOC(STATS_AST, sizeof *js);
+	return new_node(AST_JOIN_STATEMENT, js);
+}
+
 Node *
 new_logical_not_expression(Node *booleanExpression)
 {
-	LogicalNotExpression *lne = malloc(sizeof *lne);
-	lne->booleanExpression = booleanExpression;
-	return new_node(AST_LOGICAL_NOT_EXPRESSION, lne);
+	LogicalNotExpression key = {.booleanExpression = booleanExpression};
+	Node *node = ast_cons_find(AST_LOGICAL_NOT_EXPRESSION, &key);
+	if (node != NULL) {
+		return node;
+	}
+	LogicalNotExpression *lne = STATS_ALLOC(STATS_AST, sizeof *lne);
+	*lne = key;
+	return ast_cons_add(new_node(AST_LOGICAL_NOT_EXPRESSION, lne));
 }
 
 Node *
 new_logical_operand(Node *left, const char *operator, Node *right)
 {
-	LogicalOperand *lo = malloc(sizeof *lo);
-	lo->left = left;
-	lo->operator = operator;
-	lo->right = right;
-	return new_node(AST_LOGICAL_OPERAND, lo);
+	LogicalOperand key = {.left = left, .operator = operator, .right = right};
+	Node *node = ast_cons_find(AST_LOGICAL_OPERAND, &key);
+	if (node != NULL) {
+		return node;
+	}
+	LogicalOperand *lo = STATS_ALLOC(STATS_AST, sizeof *lo);
+	*lo = key;
+	return ast_cons_add(new_node(AST_LOGICAL_OPERAND, lo));
 }
 
 Node *
 new_number_literal(const char *value)
 {
-	NumberLiteral *nl = malloc(sizeof *nl);
-	nl->value = value;
-	return new_node(AST_NUMBER_LITERAL, nl);
+	NumberLiteral key = {.value = value};
+	Node *node = ast_cons_find(AST_NUMBER_LITERAL, &key);
+	if (node != NULL) {
+		return node;
+	}
+	NumberLiteral *nl = STATS_ALLOC(STATS_AST, sizeof *nl);
+	*nl = key;
+	return ast_cons_add(new_node(AST_NUMBER_LITERAL, nl));
 }
 
 Node *
 new_print_statement(Node *expression)
 {
-	PrintStatement *ps = malloc(sizeof *ps);
+	PrintStatement *ps = STATS_ALLOC(STATS_AST, sizeof *ps);
 	ps->expression = expression;
 	return new_node(AST_PRINT_STATEMENT, ps);
 }
@@ -147,11 +383,19 @@ new_print_statement(Node *expression)
 Node *
 new_return_statement(Node *expression)
 {
-	PrintStatement *ps = malloc(sizeof *ps);
+	PrintStatement *ps = STATS_ALLOC(STATS_AST, sizeof *ps);
 	ps->expression = expression;
 	return new_node(AST_RETURN_STATEMENT, ps);
 }
 
+Node *
+new_spawn_statement(Node *callExpression)
+{
+	SpawnStatement *ss = STATS_ALLOC(STATS_AST, sizeof *ss);
+	ss->callExpression = callExpression;
+	return new_node(AST_SPAWN_STATEMENT, ss);
+}
+
 // StatementVisitor interface {
 // 	String() string
 // 	visitStatement(scope *variableScope) *statement
@@ -160,26 +404,35 @@ new_return_statement(Node *expression)
 Node *
 new_string_literal(const char *value)
 {
-	StringLiteral *sl = malloc(sizeof *sl);
-	sl->value = value;
-	return new_node(AST_STRING_LITERAL, sl);
+	StringLiteral key = {.value = value};
+	Node *node = ast_cons_find(AST_STRING_LITERAL, &key);
+	if (node != NULL) {
+		return node;
+	}
+	StringLiteral *sl = STATS_ALLOC(STATS_AST, sizeof *sl);
+	*sl = key;
+	return ast_cons_add(new_node(AST_STRING_LITERAL, sl));
 }
 
 Node *
 new_term(Node *left, const char *operator, Node *right)
 {
-	Term *t = malloc(sizeof *t);
-	t->left = left;
-	t->operator = operator;
-	t->right = right;
-	return new_node(AST_TERM, t);
+	Term key = {.left = left, .operator = operator, .right = right};
+	Node *node = ast_cons_find(AST_TERM, &key);
+	if (node != NULL) {
+		return node;
+	}
+	Term *t = STATS_ALLOC(STATS_AST, sizeof *t);
+	*t = key;
+	return ast_cons_add(new_node(AST_TERM, t));
 }
 
 Node *
 new_while_statement(Node *booleanExpression, Node *block)
 {
-	WhileStatement *ws = malloc(sizeof *ws);
+	WhileStatement *ws = STATS_ALLOC(STATS_AST, sizeof *ws);
 	ws->booleanExpression = booleanExpression;
 	ws->block = block;
+	ws->integer = 0;
 	return new_node(AST_WHILE_STATEMENT, ws);
 }
@@ -1,8 +1,11 @@
 #ifndef AST_H
 #define AST_H 1
 #include "list.h"
+#include <stddef.h>
+#include <stdint.h>
 
 typedef enum ast_type {
+	AST_ARRAY_LITERAL,
 	AST_ASSIGNMENT_STATEMENT,
 	AST_BLOCK,
 	AST_BOOLEAN_EXPRESSION,
@@ -14,11 +17,14 @@ typedef enum ast_type {
 	AST_FUNCTION_STATEMENT,
 	AST_IDENTIFIER,
 	AST_IF_STATEMENT,
+	AST_INDEX_EXPRESSION,
+	AST_JOIN_STATEMENT,
 	AST_LOGICAL_NOT_EXPRESSION,
 	AST_LOGICAL_OPERAND,
 	AST_NUMBER_LITERAL,
 	AST_PRINT_STATEMENT,
 	AST_RETURN_STATEMENT,
+	AST_SPAWN_STATEMENT,
 	AST_STRING_LITERAL,
 	AST_TERM,
 	AST_WHILE_STATEMENT
@@ -29,6 +35,20 @@ typedef struct {
 	const void *value;
 } Node;
 Node *new_node(AstType type, const void *value);
+const char *node_str(Node *node);
+
+typedef struct ast_cons {
+	Node **entries;
+	size_t len, cap;
+} AstCons;
+AstCons *new_ast_cons(void);
+AstCons *ast_cons_use(AstCons *cons);
+void ast_cons_free(AstCons *cons);
+
+typedef struct array_literal {
+	List *elements;
+} ArrayLiteral;
+Node *new_array_literal(List *elements);
 
 typedef struct assignment_statement {
 	const char *id;
@@ -60,8 +80,9 @@ Node *new_break_statement(void);
 typedef struct call_expression {
 	const char *name;
 	List *arguments;
+	uint32_t offset;
 } CallExpression;
-Node *new_call_expression(const char *name, List *arguments);
+Node *new_call_expression(const char *name, List *arguments, uint32_t offset);
 
 typedef struct continue_statement {
 } ContinueStatement;
@@ -77,8 +98,12 @@ typedef struct function_statement {
 	const char *name;
 	List *parameters;
 	Node *block;
+	int pure;
+	int integer;
+	uint32_t offset;
+	uint32_t body, end, depth;
 } FunctionStatement;
-Node *new_function_statement(const char *name, List *parameters, Node *block);
+Node *new_function_statement(const char *name, List *parameters, Node *block, uint32_t offset);
 
 typedef struct identifier {
 	const char *value;
@@ -91,6 +116,16 @@ typedef struct if_statement {
 } IfStatement;
 Node *new_if_statement(Node *booleanExpression, Node *block);
 
+typedef struct index_expression {
+	Node *array;
+	Node *index;
+} IndexExpression;
+Node *new_index_expression(Node *array, Node *index);
+
+typedef struct join_statement {
+} JoinStatement;
+Node *new_join_statement(void);
+
 typedef struct logical_not_expression {
 	Node *booleanExpression;
 } LogicalNotExpression;
@@ -118,6 +153,11 @@ typedef struct return_statement {
 } ReturnStatement;
 Node *new_return_statement(Node *expression);
 
+typedef struct spawn_statement {
+	Node *callExpression;
+} SpawnStatement;
+Node *new_spawn_statement(Node *callExpression);
+
 typedef struct string_literal {
 	const char *value;
 } StringLiteral;
@@ -133,6 +173,7 @@ Node *new_term(Node *left, const char *operator, Node *right);
 typedef struct while_statement {
 	Node *booleanExpression;
 	Node *block;
+	int integer;
 } WhileStatement;
 Node *new_while_statement(Node *booleanExpression, Node *block);
 #endif
@@ -0,0 +1,371 @@
+#include "../arena.h"
+#include "../ast.h"
+#include "../lex.h"
+#include "../list.h"
+#include "../parse.h"
+#include "../stats.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Front-end benchmark. Each shape writes a seeded synthetic program to a
+ * temporary file, lexes it and parses it several times and prints one
+ * JSON object per shape with the median timings, so runs with the same
+ * seed and size can be compared across builds. Each shape runs in its own
+ * child process, so peak_rss_kb does not depend on which shapes ran
+ * before it, and each run builds its tree in an arena freed after it, so
+ * peak_rss_kb does not depend on the run count either. One extra untimed
+ * parse with the counters on reports the allocations the parser made.
+ * With -c the parser hash-conses expression nodes and the output also
+ * reports how many constructor calls were answered by an existing node.
+ * With -l fn bodies are parsed lazily and only those reachable from a
+ * call are parsed, as with --lazy.
+ *
+ *	cc -O2 -o bench/bench bench/bench.c arena.c ast.c lex.c lines.c list.c parse.c \
+ *	    stats.c
+ *	bench/bench [-c] [-l] [-s seed] [-n size] [-r runs] \
+ *	    [shape ...]
+ */
+
+typedef struct {
+	const char *name;
+	void (*generate)(FILE *f, int size);
+} Shape;
+
+static unsigned long seed = 1;
+static int hashcons;
+static int lazy;
+
+static unsigned long
+bench_rand(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+static void
+bench_id(FILE *f)
+{
+	int len = bench_rand() % 12;
+	int i;
+	fputc('q', f);
+	for (i = 0; i < len; i++) {
+		fputc('a' + bench_rand() % 26, f);
+	}
+}
+
+static void
+generate_array(FILE *f, int size)
+{
+	int i, j;
+	for (i = 0; i < size * 5; i++) {
+		int len = 32 + bench_rand() % 32;
+		fprintf(f, "var a%d = [%lu", i, bench_rand() % 1000);
+		for (j = 1; j < len; j++) {
+			fprintf(f, ", %lu", bench_rand() % 1000);
+		}
+		fprintf(f, "];\nvar s%d = sum(map(a%d, \"*\", 2)) + dot(a%d, a%d);\n", i, i, i, i);
+		fprintf(f, "var i%d = 0;\nwhile i%d < %d {\n  s%d = s%d - a%d[i%d] * 2 - a%d[i%d] * a%d[i%d];\n"
+		    "  i%d = i%d + 1;\n}\n", i, i, len, i, i, i, i, i, i, i, i, i, i);
+	}
+}
+
+static void
+generate_expression(FILE *f, int size)
+{
+	static const char *operators[] = {"+", "-", "*", "/", "+", "*", "and", "or"};
+	int i;
+	for (i = 0; i < size; i++) {
+		fprintf(f, "var x%d = 1", i);
+		int terms = 50 + bench_rand() % 50;
+		int j;
+		for (j = 0; j < terms; j++) {
+			fprintf(f, " %s %lu", operators[bench_rand() % 8], bench_rand() % 1000);
+		}
+		fprintf(f, ";\n");
+	}
+}
+
+static void
+generate_function(FILE *f, int size)
+{
+	int i;
+	for (i = 0; i < size * 20; i++) {
+		fprintf(f, "fn f%d(a, b, c) {\n  var r = a * b + c;\n  if r > %lu {\n    return f%d(r - 1, b, c);\n  }\n  return r;\n}\n",
+		    i, bench_rand() % 100, i);
+	}
+}
+
+static void
+generate_identifier(FILE *f, int size)
+{
+	int i;
+	for (i = 0; i < size * 50; i++) {
+		bench_id(f);
+		fprintf(f, " = ");
+		bench_id(f);
+		fprintf(f, " + ");
+		bench_id(f);
+		fprintf(f, "(");
+		bench_id(f);
+		fprintf(f, ", ");
+		bench_id(f);
+		fprintf(f, ");\n");
+	}
+}
+
+static void
+generate_nesting(FILE *f, int size)
+{
+	int i, j;
+	for (i = 0; i < size; i++) {
+		int depth = 50 + bench_rand() % 50;
+		for (j = 0; j < depth; j++) {
+			fprintf(f, "%s x < %d {\n", j % 2 ? "if" : "while", j);
+		}
+		fprintf(f, "print ((((x))));\n");
+		for (j = 0; j < depth; j++) {
+			fprintf(f, "}\n");
+		}
+	}
+}
+
+static void
+generate_string(FILE *f, int size)
+{
+	int i, j;
+	for (i = 0; i < size * 10; i++) {
+		int len = 100 + bench_rand() % 4000;
+		fprintf(f, "print \"");
+		for (j = 0; j < len; j++) {
+			fputc('a' + bench_rand() % 26, f);
+		}
+		fprintf(f, "\";\n");
+	}
+}
+
+static Shape shapes[] = {
+	{"array", generate_array},
+	{"expression", generate_expression},
+	{"function", generate_function},
+	{"identifier", generate_identifier},
+	{"nesting", generate_nesting},
+	{"string", generate_string},
+};
+
+static long
+bench_nodes(Node *node)
+{
+	ListNode *n;
+	long count = 1;
+	if (node == NULL) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			count += bench_nodes((Node *)n->value);
+		}
+		return count;
+	case AST_ASSIGNMENT_STATEMENT:
+		return count + bench_nodes(((AssignmentStatement *)node->value)->expression);
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			count += bench_nodes((Node *)n->value);
+		}
+		return count;
+	case AST_BOOLEAN_EXPRESSION:
+		return count + bench_nodes(((BooleanExpression *)node->value)->left) +
+		    bench_nodes(((BooleanExpression *)node->value)->right);
+	case AST_CALL_EXPRESSION:
+		for (n = ((CallExpression *)node->value)->arguments->head; n; n = n->next) {
+			count += bench_nodes((Node *)n->value);
+		}
+		return count;
+	case AST_DECLARATION_STATEMENT:
+		return count + bench_nodes(((DeclarationStatement *)node->value)->expression);
+	case AST_FUNCTION_STATEMENT:
+		return count + bench_nodes(((FunctionStatement *)node->value)->block);
+	case AST_IF_STATEMENT:
+		return count + bench_nodes(((IfStatement *)node->value)->booleanExpression) +
+		    bench_nodes(((IfStatement *)node->value)->block);
+	case AST_INDEX_EXPRESSION:
+		return count + bench_nodes(((IndexExpression *)node->value)->array) +
+		    bench_nodes(((IndexExpression *)node->value)->index);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return count + bench_nodes(((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_LOGICAL_OPERAND:
+		return count + bench_nodes(((LogicalOperand *)node->value)->left) +
+		    bench_nodes(((LogicalOperand *)node->value)->right);
+	case AST_PRINT_STATEMENT:
+		return count + bench_nodes(((PrintStatement *)node->value)->expression);
+	case AST_RETURN_STATEMENT:
+		return count + bench_nodes(((ReturnStatement *)node->value)->expression);
+	case AST_SPAWN_STATEMENT:
+		return count + bench_nodes(((SpawnStatement *)node->value)->callExpression);
+	case AST_TERM:
+		return count + bench_nodes(((Term *)node->value)->left) +
+		    bench_nodes(((Term *)node->value)->right);
+	case AST_WHILE_STATEMENT:
+		return count + bench_nodes(((WhileStatement *)node->value)->booleanExpression) +
+		    bench_nodes(((WhileStatement *)node->value)->block);
+	default:
+		return count;
+	}
+}
+
+static long
+bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+bench_shape(Shape *shape, int size, int runs)
+{
+	char path[] = "/tmp/benchXXXXXX";
+	long *lex = malloc(runs * sizeof *lex);
+	long *parse = malloc(runs * sizeof *parse);
+	long tokens = 0, nodes = 0, bytes, allocs = 0, allocbytes = 0;
+	size_t arena = 0, heap = 0;
+	unsigned long base = seed;
+	int i;
+	FILE *f = fdopen(mkstemp(path), "w");
+	shape->generate(f, size);
+	bytes = ftell(f);
+	fclose(f);
+	for (i = 0; i <= runs; i++) {
+		Arena *ast = new_arena(65536, 0);
+		Arena *prev = arena_use(ast);
+		Lexer *lexer;
+		long start;
+		if (i < runs) {
+			lexer = new_lexer(path);
+			start = bench_now();
+			for (tokens = 1; strcmp(lexer_lex(lexer)->symbol, "eof"); tokens++)
+				;
+			lex[i] = bench_now() - start;
+			lexer_close(lexer);
+			arena_free(lexer->arena);
+		}
+
+		AstCons *cons = hashcons ? new_ast_cons() : NULL;
+		ast_cons_use(cons);
+		stats.enabled = i == runs;
+		struct mallinfo2 before = mallinfo2();
+		lexer = new_lexer(path);
+		start = bench_now();
+		Parser *parser = new_parser(lexer);
+		parser->lazy = lazy;
+		Node *node = parser_block(parser);
+		if (lazy) {
+			parser_resolve(parser, node);
+		}
+		long ns = bench_now() - start;
+		struct mallinfo2 after = mallinfo2();
+		if (i < runs) {
+			parse[i] = ns;
+			nodes = bench_nodes(node);
+			arena = lexer->arena->bytes;
+			heap = after.uordblks - before.uordblks;
+		}
+		parser_close(parser);
+		lexer_close(lexer);
+		arena_free(lexer->arena);
+		stats.enabled = 0;
+		ast_cons_use(NULL);
+		if (cons) {
+			ast_cons_free(cons);
+		}
+		arena_use(prev);
+		arena_free(ast);
+	}
+	remove(path);
+	qsort(lex, runs, sizeof *lex, bench_compare);
+	qsort(parse, runs, sizeof *parse, bench_compare);
+	for (i = 0; i < STATS_SUBSYSTEMS; i++) {
+		allocs += stats.mallocs[i];
+		allocbytes += stats.bytes[i];
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	printf("{\"shape\":\"%s\",\"seed\":%lu,\"size\":%d,\"runs\":%d,\"bytes\":%ld,"
+	    "\"tokens\":%ld,\"lex_ns\":%ld,\"tokens_per_sec\":%.0f,"
+	    "\"nodes\":%ld,\"parse_ns\":%ld,\"nodes_per_sec\":%.0f,"
+	    "\"arena_bytes\":%zu,\"heap_bytes\":%zu,\"allocs\":%ld,\"alloc_bytes\":%ld,"
+	    "\"peak_rss_kb\":%ld",
+	    shape->name, base, size, runs, bytes,
+	    tokens, lex[runs / 2], tokens * 1e9 / lex[runs / 2],
+	    nodes, parse[runs / 2], nodes * 1e9 / parse[runs / 2],
+	    arena, heap, allocs, allocbytes, ru.ru_maxrss);
+	if (hashcons) {
+		printf(",\"cons_lookups\":%ld,\"cons_hits\":%ld,\"cons_ratio\":%.3f",
+		    stats.conslookups, stats.conshits,
+		    stats.conslookups ? (double)stats.conshits / stats.conslookups : 0.0);
+	}
+	printf("}\n");
+	free(lex);
+	free(parse);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long base = 1;
+	int size = 100, runs = 5;
+	int i, all = 1;
+	size_t j;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c")) {
+			hashcons = 1;
+		} else if (!strcmp(argv[i], "-l")) {
+			lazy = 1;
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			base = strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			size = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else {
+			all = 0;
+		}
+	}
+	if (runs < 1) {
+		runs = 1;
+	}
+	for (j = 0; j < sizeof shapes / sizeof *shapes; j++) {
+		int selected = all;
+		for (i = 1; i < argc && !selected; i++) {
+			selected = !strcmp(argv[i], shapes[j].name);
+		}
+		if (selected) {
+			seed = base ? base : 1;
+			fflush(stdout);
+			pid_t pid = fork();
+			if (pid == 0) {
+				bench_shape(&shapes[j], size, runs);
+				fflush(stdout);
+				_exit(0);
+			}
+			waitpid(pid, NULL, 0);
+		}
+	}
+	return 0;
+}
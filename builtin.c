@@ -0,0 +1,37 @@
+#include "builtin.h"
+#include <string.h>
+
+/*
+ * Array builtins. Arrays hold integers only, so each of these works on
+ * one contiguous run of unboxed values: sum, min and max reduce an
+ * array, dot multiplies two arrays pairwise and adds the products, and
+ * map and filter take an operator string and a scalar, as in
+ * map(a, "*", 2) or filter(a, ">", 0). None of them has side effects.
+ * read(fd) and write(fd, s) are the I/O builtins, on a file, pipe or
+ * socket descriptor; they return the data read and the number of bytes
+ * written, and since they have effects no caller of theirs is pure.
+ * A function declared with the same name hides the builtin.
+ */
+
+static const Builtin builtins[] = {
+	{"dot", 2, TYPE_INT, 1},
+	{"filter", 3, TYPE_ARRAY, 1},
+	{"map", 3, TYPE_ARRAY, 1},
+	{"max", 1, TYPE_INT, 1},
+	{"min", 1, TYPE_INT, 1},
+	{"read", 1, TYPE_STRING, 0},
+	{"sum", 1, TYPE_INT, 1},
+	{"write", 2, TYPE_INT, 0},
+};
+
+const Builtin *
+builtin_lookup(const char *name)
+{
+	size_t i;
+	for (i = 0; i < sizeof builtins / sizeof *builtins; i++) {
+		if (!strcmp(builtins[i].name, name)) {
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
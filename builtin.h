@@ -0,0 +1,11 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H 1
+#include "types.h"
+typedef struct {
+	const char *name;
+	int arity;
+	Type type;
+	int pure;
+} Builtin;
+const Builtin *builtin_lookup(const char *name);
+#endif
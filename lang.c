@@ -0,0 +1,132 @@
+#include "arena.h"
+#include "ast.h"
+#include "lang.h"
+#include "lex.h"
+#include "opt.h"
+#include "parse.h"
+#include "pure.h"
+#include "types.h"
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Embedding entry points. lang_compile parses and analyzes a script held
+ * in memory into a LangProgram that owns all of its memory and is not
+ * modified afterwards, so one program can be shared by any number of
+ * threads. Every allocation made while compiling goes to the program's
+ * arenas, nothing is kept in globals, and errors are reported through
+ * LangError instead of exiting.
+ */
+
+#define LANG_CHUNK 65536
+
+LangContext *
+new_lang_context(void)
+{
+	LangContext *context = malloc(sizeof *context);
+	context->chunksize = LANG_CHUNK;
+	context->limit = 0;
+	context->maxdepth = PARSER_MAX_DEPTH;
+	context->hashcons = 0;
+	return context;
+}
+
+void
+lang_context_free(LangContext *context)
+{
+	free(context);
+}
+
+LangProgram *
+lang_compile(LangContext *context, const char *src, size_t len, LangError *error)
+{
+	jmp_buf recover;
+	Lexer *volatile lexer = NULL;
+	Parser *volatile parser = NULL;
+	const char *volatile failure = "memory limit exceeded";
+	AstCons *volatile cons = context->hashcons ? new_ast_cons() : NULL;
+	LangProgram *program = malloc(sizeof *program);
+	program->arena = new_arena(context->chunksize, context->limit);
+	program->arena->recover = &recover;
+	Arena *prev = arena_use(program->arena);
+	AstCons *prevcons = ast_cons_use(cons);
+	if (setjmp(recover)) {
+		if (lexer && lexer->error[0]) {
+			strcpy(error->message, lexer->error);
+			error->line = lexer->errorline;
+			error->column = lexer->errorcolumn;
+		} else {
+			strcpy(error->message, failure);
+			error->line = 0;
+			error->column = 0;
+		}
+		arena_use(prev);
+		ast_cons_use(prevcons);
+		if (cons) {
+			ast_cons_free(cons);
+		}
+		if (parser) {
+			parser_close(parser);
+		}
+		if (lexer) {
+			lexer_close(lexer);
+			arena_free(lexer->arena);
+		}
+		arena_free(program->arena);
+		free(program);
+		return NULL;
+	}
+	lexer = new_lexer_buffer(src, len);
+	if (lexer == NULL) {
+		failure = "cannot open script";
+		longjmp(recover, 1);
+	}
+	lexer->recover = &recover;
+	parser = new_parser(lexer);
+	parser->maxdepth = context->maxdepth;
+	Node *block = parser_block(parser);
+	pure_analyze(block);
+	type_analyze(block, lexer);
+	if (cons == NULL) {
+		/* opt conses its rewrites; lend it a table the recovery frees */
+		cons = new_ast_cons();
+		ast_cons_use(cons);
+	}
+	opt_optimize(block);
+	parser_close(parser);
+	arena_use(prev);
+	ast_cons_use(prevcons);
+	if (cons) {
+		ast_cons_free(cons);
+	}
+	program->arena->recover = NULL;
+	program->block = block;
+	program->strings = lexer->arena;
+	program->lines = lexer->lines;
+	lexer->lines = NULL;
+	program->image = NULL;
+	program->imagesize = 0;
+	lexer_close(lexer);
+	return program;
+}
+
+void
+lang_program_position(const LangProgram *program, uint32_t offset, int *line, int *column)
+{
+	line_table_find(program->lines, offset, line, column);
+}
+
+void
+lang_program_free(LangProgram *program)
+{
+	if (program->image) {
+		munmap(program->image, program->imagesize);
+	} else {
+		arena_free(program->arena);
+		arena_free(program->strings);
+		line_table_free(program->lines);
+	}
+	free(program);
+}
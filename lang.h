@@ -0,0 +1,30 @@
+#ifndef LANG_H
+#define LANG_H 1
+#include "arena.h"
+#include "ast.h"
+#include "lines.h"
+#include <stddef.h>
+typedef struct {
+	size_t chunksize;
+	size_t limit;
+	int maxdepth;
+	int hashcons;
+} LangContext;
+typedef struct {
+	const Node *block;
+	Arena *arena;
+	Arena *strings;
+	LineTable *lines;
+	void *image;
+	size_t imagesize;
+} LangProgram;
+typedef struct {
+	char message[256];
+	int line, column;
+} LangError;
+LangContext *new_lang_context(void);
+void lang_context_free(LangContext *context);
+LangProgram *lang_compile(LangContext *context, const char *src, size_t len, LangError *error);
+void lang_program_position(const LangProgram *program, uint32_t offset, int *line, int *column);
+void lang_program_free(LangProgram *program);
+#endif
@@ -1,30 +1,123 @@
 #include "lex.h"
+#include "stats.h"
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef LEXER_ARENA_CHUNK
+#define LEXER_ARENA_CHUNK 65536
+#endif
+#ifndef LEXER_ARENA_LIMIT
+#define LEXER_ARENA_LIMIT 0
+#endif
+
 static Token *lexer_consume(Lexer *lexer, const char *pattern, const char *token);
+static Token *lexer_consume_keyword(Lexer *lexer, const char *keyword);
 static Token *lexer_consume_string(Lexer *lexer);
 static Token *new_token(Lexer *lexer, const char *symbol, const char *value);
 
-Lexer *
-new_lexer(const char *filepath)
+static Lexer *
+lexer_open(FILE *in)
 {
-	Lexer *lexer = malloc(sizeof *lexer);
-	lexer->in = fopen(filepath, "r");
+	if (in == NULL) {
+		return NULL;
+	}
+	Lexer *lexer = STATS_ALLOC(STATS_LEXER, sizeof *lexer);
+	lexer->in = in;
 	lexer->out = stdout;
-	lexer->line = 1;
-	lexer->column = 1;
-	lexer->prev = '\0';
+	lexer->offset = 0;
+	lexer->lines = new_line_table();
+	lexer->arena = new_arena(LEXER_ARENA_CHUNK, LEXER_ARENA_LIMIT);
+	lexer->buf = STATS_MALLOC(STATS_LEXER, 256);
+	lexer->bufcap = 256;
+	const char *lexdebug = getenv("LEXDEBUG");
+	lexer->debug = lexdebug && strcmp(lexdebug, "");
+	lexer->recover = NULL;
+	lexer->error[0] = '\0';
+	lexer->errorline = 0;
+	lexer->errorcolumn = 0;
+	lexer->recovery = 0;
+	lexer->errors = NULL;
+	lexer->nerrors = lexer->errorscap = 0;
 	return lexer;
 }
 
+Lexer *
+new_lexer(const char *filepath)
+{
+	return lexer_open(fopen(filepath, "r"));
+}
+
+Lexer *
+new_lexer_buffer(const char *buf, size_t len)
+{
+	return lexer_open(fmemopen((void *)buf, len, "r"));
+}
+
+/*
+ * In recovery mode every error is also appended to lexer->errors, so
+ * that one pass can report all of them; lexer_diagnose records without
+ * unwinding and is used where scanning can simply carry on.
+ */
+static void
+lexer_verror(Lexer *lexer, uint32_t offset, const char *fmt, va_list args)
+{
+	vsnprintf(lexer->error, sizeof lexer->error, fmt, args);
+	line_table_find(lexer->lines, offset, &lexer->errorline, &lexer->errorcolumn);
+	if (lexer->recovery) {
+		if (lexer->nerrors == lexer->errorscap) {
+			lexer->errorscap = lexer->errorscap ? lexer->errorscap * 2 : 16;
+			lexer->errors = realloc(lexer->errors, lexer->errorscap * sizeof *lexer->errors);
+		}
+		LexerError *e = &lexer->errors[lexer->nerrors++];
+		memcpy(e->message, lexer->error, sizeof e->message);
+		e->line = lexer->errorline;
+		e->column = lexer->errorcolumn;
+	}
+}
+
+void
+lexer_diagnose(Lexer *lexer, uint32_t offset, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	lexer_verror(lexer, offset, fmt, args);
+	va_end(args);
+}
+
+void
+lexer_error(Lexer *lexer, uint32_t offset, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	lexer_verror(lexer, offset, fmt, args);
+	va_end(args);
+	if (lexer->recover) {
+		longjmp(*lexer->recover, 1);
+	}
+	fprintf(stderr, "%s at line %d, column %d\n", lexer->error, lexer->errorline, lexer->errorcolumn);
+	exit(1);
+}
+
 void
 lexer_close(Lexer *lexer)
 {
 	fclose(lexer->in);
-	fclose(lexer->out);
+	free(lexer->buf);
+	free(lexer->errors);
+	line_table_free(lexer->lines);
+}
+
+static void
+lexer_buffer(Lexer *lexer, int len, int c)
+{
+	if (len + 1 >= lexer->bufcap) {
+		lexer->bufcap *= 2;
+		lexer->buf = realloc(lexer->buf, lexer->bufcap);
+	}
+	lexer->buf[len] = c;
 }
 
 int
@@ -40,14 +133,15 @@ lexer_has_more(Lexer *lexer)
 static Token *
 new_token(Lexer *lexer, const char *symbol, const char *value)
 {
-	const char *lexdebug = getenv("LEXDEBUG");
-	if (lexdebug && strcmp(lexdebug, "")) {
-		printf("%s %d %d %s\n", symbol, lexer->line, lexer->column, value);
+	STATS_TOKEN(symbol);
+	if (lexer->debug) {
+		int line, column;
+		line_table_find(lexer->lines, lexer->offset, &line, &column);
+		printf("%s %d %d %s\n", symbol, line, column, value);
 	}
-	Token *token = malloc(sizeof *token);
+	Token *token = arena_alloc(lexer->arena, sizeof *token);
 	token->symbol = symbol;
-	token->line = lexer->line;
-	token->column = lexer->column;
+	token->offset = lexer->offset;
 	token->value = value;
 	return token;
 }
@@ -55,7 +149,6 @@ new_token(Lexer *lexer, const char *symbol, const char *value)
 static Token *
 lexer_consume(Lexer *lexer, const char *pattern, const char *symbol)
 {
-	char *value = malloc(256);
 	long offset = ftell(lexer->in);
 	int len;
 	for (len = 0; pattern[len]; len++) {
@@ -64,21 +157,37 @@ lexer_consume(Lexer *lexer, const char *pattern, const char *symbol)
 			fseek(lexer->in, offset, SEEK_SET);
 			return NULL;
 		}
-		value[len] = c;
 	}
-	if (value[0]) {
-		Token *token = new_token(lexer, symbol, value);
-		lexer->column += len;
-		return token;
+	if (len) {
+		return new_token(lexer, symbol, pattern);
 	}
 	return NULL;
 }
 
+/*
+ * Like lexer_consume, but only matches when the keyword is not the start
+ * of a longer identifier, so that names such as "joined" stay valid.
+ */
+static Token *
+lexer_consume_keyword(Lexer *lexer, const char *keyword)
+{
+	long offset = ftell(lexer->in);
+	int len = strlen(keyword);
+	int i;
+	for (i = 0; i <= len; i++) {
+		int c = fgetc(lexer->in);
+		if (i < len ? c != keyword[i] : isalnum(c) || c == '_') {
+			fseek(lexer->in, offset, SEEK_SET);
+			return NULL;
+		}
+	}
+	fseek(lexer->in, offset + len, SEEK_SET);
+	return new_token(lexer, keyword, keyword);
+}
+
 static Token *
 lexer_consume_string(Lexer *lexer)
 {
-	char *value = malloc(8192);
-	value[0] = '\0';
 	char prev = '\0';
 	int c, len;
 	for (len = 0; lexer_has_more(lexer); len++) {
@@ -86,19 +195,18 @@ lexer_consume_string(Lexer *lexer)
 		if (prev != '\\' && c == '"') {
 			break;
 		}
+		if (c == '\n') {
+			line_table_add(lexer->lines, lexer->offset + len + 2);
+		}
 		prev = c;
-		value[len] = c;
+		lexer_buffer(lexer, len, c);
 	}
-	Token *token = new_token(lexer, "string", value);
-	lexer->column += len;
-	return token;
+	return new_token(lexer, "string", arena_strndup(lexer->arena, lexer->buf, len));
 }
 
 static Token *
 lexer_consume_id(Lexer *lexer)
 {
-	char *value = malloc(256);
-	value[0] = '\0';
 	int c, len;
 	for (len = 0; lexer_has_more(lexer); len++) {
 		c = fgetc(lexer->in);
@@ -108,21 +216,18 @@ lexer_consume_id(Lexer *lexer)
 				return NULL;
 			}
 			if (!isdigit(c)) {
+				ungetc(c, lexer->in);
 				break;
 			}
 		}
-		value[len] = c;
+		lexer_buffer(lexer, len, c);
 	}
-	ungetc(c, lexer->in);
-	lexer->column += len;
-	return new_token(lexer, "id", value);
+	return new_token(lexer, "id", arena_strndup(lexer->arena, lexer->buf, len));
 }
 
 static Token *
 lexer_consume_number(Lexer *lexer)
 {
-	char *value = malloc(256);
-	value[0] = '\0';
 	int c, len;
 	for (len = 0; lexer_has_more(lexer); len++) {
 		c = fgetc(lexer->in);
@@ -130,20 +235,50 @@ lexer_consume_number(Lexer *lexer)
 			ungetc(c, lexer->in);
 			break;
 		}
-		value[len] = c;
+		lexer_buffer(lexer, len, c);
 	}
-	if (value[0]) {
-		lexer->column += len;
-		return new_token(lexer, "number", value);
+	if (len) {
+		return new_token(lexer, "number", arena_strndup(lexer->arena, lexer->buf, len));
 	}
 	return NULL;
 }
 
+/*
+ * Reads raw input up to the '}' that closes the innermost of depth open
+ * blocks and leaves it unread. Only braces, strings and newlines are
+ * looked at and no tokens are made, so skipping a block is much cheaper
+ * than lexing it.
+ */
+void
+lexer_skip_block(Lexer *lexer, int depth)
+{
+	uint32_t offset = ftell(lexer->in);
+	char prev = '\0';
+	int c, string = 0;
+	for (; (c = fgetc(lexer->in)) != EOF; offset++) {
+		if (c == '\n') {
+			line_table_add(lexer->lines, offset + 1);
+		}
+		if (string) {
+			string = prev == '\\' || c != '"';
+		} else if (c == '"') {
+			string = 1;
+		} else if (c == '{') {
+			depth++;
+		} else if (c == '}' && --depth == 0) {
+			ungetc(c, lexer->in);
+			return;
+		}
+		prev = c;
+	}
+}
+
 Token *
 lexer_lex(Lexer *lexer)
 {
 	Token *t = NULL;
-	if (lexer_has_more(lexer)) {
+	while (lexer_has_more(lexer)) {
+		lexer->offset = ftell(lexer->in);
 		if (t == NULL) t = lexer_consume(lexer, "var", "var");
 		if (t == NULL) t = lexer_consume(lexer, "print", "print");
 		if (t == NULL) t = lexer_consume(lexer, "if", "if");
@@ -152,6 +287,8 @@ lexer_lex(Lexer *lexer)
 		if (t == NULL) t = lexer_consume(lexer, "continue", "continue");
 		if (t == NULL) t = lexer_consume(lexer, "fn", "fn");
 		if (t == NULL) t = lexer_consume(lexer, "return", "return");
+		if (t == NULL) t = lexer_consume_keyword(lexer, "spawn");
+		if (t == NULL) t = lexer_consume_keyword(lexer, "join");
 		if (t == NULL) t = lexer_consume(lexer, "true", "true");
 		if (t == NULL) t = lexer_consume(lexer, "false", "false");
 		if (t == NULL) t = lexer_consume(lexer, "==", "==");
@@ -168,36 +305,33 @@ lexer_lex(Lexer *lexer)
 		int ws = 0;
 		int c = fgetc(lexer->in);
 		while (strchr(" \t\r", c)) {
-			if (c != '\r') {
-				lexer->column++;
-			}
 			c = fgetc(lexer->in);
 			ws = 1;
 		}
 		if (ws) {
 			ungetc(c, lexer->in);
-			return lexer_lex(lexer);
+			continue;
 		}
 		if (c == '\n') {
-			lexer->line++;
-			lexer->column = 1;
-			return lexer_lex(lexer);
+			line_table_add(lexer->lines, lexer->offset + 1);
+			continue;
 		}
 		if (c == '"') {
 			t = lexer_consume_string(lexer);
 		} else if (c == ';') {
 			t = new_token(lexer, ";", ";");
-		} else if (strchr("=+-*/(){}<>,", c)) {
-			char *s = malloc(2);
-			s[0] = c;
-			s[1] = '\0';
-			t = new_token(lexer, s, s);
+		} else if (strchr("=+-*/(){}[]<>,", c)) {
+			char s = c;
+			const char *v = arena_strndup(lexer->arena, &s, 1);
+			t = new_token(lexer, v, v);
+		} else if (lexer->recovery) {
+			lexer_diagnose(lexer, lexer->offset, "unrecognized char '%c'", c);
+			continue;
 		} else {
-			fprintf(stderr, "unrecognized char '%c' at line %d, column %d\n", c, lexer->line, lexer->column);
-			exit(1);
+			lexer_error(lexer, lexer->offset, "unrecognized char '%c'", c);
 		}
-		lexer->column++;
 		return t;
 	}
+	lexer->offset = ftell(lexer->in);
 	return new_token(lexer, "eof", "eof");
 }
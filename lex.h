@@ -1,18 +1,40 @@
 #ifndef LEX_H
 #define LEX_H 1
+#include "arena.h"
+#include "lines.h"
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 typedef struct {
 	const char *symbol;
-	int line;
-	int column;
+	uint32_t offset;
 	const char *value;
 } Token;
+typedef struct {
+	char message[256];
+	int line, column;
+} LexerError;
 typedef struct {
 	FILE *in, *out;
-	int line, column, prev, prevcolumn;
+	uint32_t offset;
+	LineTable *lines;
+	Arena *arena;
+	char *buf;
+	int bufcap;
+	int debug;
+	jmp_buf *recover;
+	char error[256];
+	int errorline, errorcolumn;
+	int recovery;
+	LexerError *errors;
+	int nerrors, errorscap;
 } Lexer;
 Lexer *new_lexer(const char *filepath);
+Lexer *new_lexer_buffer(const char *buf, size_t len);
+void lexer_diagnose(Lexer *lexer, uint32_t offset, const char *fmt, ...);
+void lexer_error(Lexer *lexer, uint32_t offset, const char *fmt, ...);
 void lexer_close(Lexer *lexer);
 int lexer_has_more(Lexer *lexer);
 Token *lexer_lex(Lexer *lexer);
+void lexer_skip_block(Lexer *lexer, int depth);
 #endif
@@ -0,0 +1,99 @@
+#include "lines.h"
+#include "stats.h"
+#include <stdlib.h>
+
+/*
+ * Source positions. Tokens and nodes keep only a byte offset into their
+ * file; the lexer records where each line starts, and line and column
+ * are worked out from that only when a message needs them. Line starts
+ * are stored as the varint-encoded length of each line, with the
+ * absolute offset of every LINES_STRIDE-th line kept as a checkpoint so
+ * that a lookup is a binary search followed by a short scan.
+ */
+
+LineTable *
+new_line_table(void)
+{
+	LineTable *lines = STATS_MALLOC(STATS_LEXER, sizeof *lines);
+	lines->checkpointscap = 16;
+	lines->checkpoints = STATS_MALLOC(STATS_LEXER, lines->checkpointscap * sizeof *lines->checkpoints);
+	lines->checkpoints[0].offset = 0;
+	lines->checkpoints[0].delta = 0;
+	lines->deltascap = 256;
+	lines->deltas = STATS_MALLOC(STATS_LEXER, lines->deltascap);
+	lines->nlines = 1;
+	lines->ndeltas = 0;
+	lines->last = 0;
+	return lines;
+}
+
+void
+line_table_add(LineTable *lines, uint32_t offset)
+{
+	if (offset <= lines->last) {
+		return;
+	}
+	uint32_t delta = offset - lines->last;
+	if (lines->ndeltas + 5 > lines->deltascap) {
+		lines->deltascap *= 2;
+		lines->deltas = realloc(lines->deltas, lines->deltascap);
+	}
+	for (; delta >= 0x80; delta >>= 7) {
+		lines->deltas[lines->ndeltas++] = delta | 0x80;
+	}
+	lines->deltas[lines->ndeltas++] = delta;
+	lines->last = offset;
+	if (lines->nlines % LINES_STRIDE == 0) {
+		size_t i = lines->nlines / LINES_STRIDE;
+		if (i == lines->checkpointscap) {
+			lines->checkpointscap *= 2;
+			lines->checkpoints = realloc(lines->checkpoints,
+			    lines->checkpointscap * sizeof *lines->checkpoints);
+		}
+		lines->checkpoints[i].offset = offset;
+		lines->checkpoints[i].delta = lines->ndeltas;
+	}
+	lines->nlines++;
+}
+
+void
+line_table_find(const LineTable *lines, uint32_t offset, int *line, int *column)
+{
+	size_t lo = 0, hi = (lines->nlines - 1) / LINES_STRIDE;
+	while (lo < hi) {
+		size_t mid = (lo + hi + 1) / 2;
+		if (lines->checkpoints[mid].offset <= offset) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	size_t n = lo * LINES_STRIDE;
+	uint32_t start = lines->checkpoints[lo].offset;
+	const unsigned char *p = lines->deltas + lines->checkpoints[lo].delta;
+	for (; n + 1 < lines->nlines; n++) {
+		uint32_t delta = 0;
+		int shift = 0;
+		do {
+			delta |= (uint32_t)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+		if (start + delta > offset) {
+			break;
+		}
+		start += delta;
+	}
+	*line = n + 1;
+	*column = offset - start + 1;
+}
+
+void
+line_table_free(LineTable *lines)
+{
+	if (lines == NULL) {
+		return;
+	}
+	free(lines->checkpoints);
+	free(lines->deltas);
+	free(lines);
+}
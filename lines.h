@@ -0,0 +1,21 @@
+#ifndef LINES_H
+#define LINES_H 1
+#include <stddef.h>
+#include <stdint.h>
+#define LINES_STRIDE 64
+typedef struct {
+	uint32_t offset;
+	uint32_t delta;
+} LineCheckpoint;
+typedef struct {
+	LineCheckpoint *checkpoints;
+	unsigned char *deltas;
+	size_t nlines, ndeltas;
+	size_t checkpointscap, deltascap;
+	uint32_t last;
+} LineTable;
+LineTable *new_line_table(void);
+void line_table_add(LineTable *lines, uint32_t offset);
+void line_table_find(const LineTable *lines, uint32_t offset, int *line, int *column);
+void line_table_free(LineTable *lines);
+#endif
@@ -1,10 +1,11 @@
 #include "list.h"
+#include "stats.h"
 #include <stdlib.h>
 
 List *
 new_list(void)
 {
-  List *list = malloc(sizeof *list);
+  List *list = STATS_ALLOC(STATS_LIST, sizeof *list);
   list->head = NULL;
   list->tail = NULL;
   return list;
@@ -13,7 +14,7 @@ new_list(void)
 void
 list_append(List *list, const void *value)
 {
-  ListNode *node = malloc(sizeof *node);
+  ListNode *node = STATS_ALLOC(STATS_LIST, sizeof *node);
   node->value = value;
   node->next = NULL;
   if (list->tail != NULL) {
@@ -25,6 +26,38 @@ list_append(List *list, const void *value)
   }
 }
 
+/* Inserts value after prev, or at the head when prev is NULL. */
+void
+list_insert(List *list, ListNode *prev, const void *value)
+{
+  ListNode *node = STATS_ALLOC(STATS_LIST, sizeof *node);
+  node->value = value;
+  node->next = prev ? prev->next : list->head;
+  if (prev != NULL) {
+    prev->next = node;
+  } else {
+    list->head = node;
+  }
+  if (node->next == NULL) {
+    list->tail = node;
+  }
+}
+
+/* Unlinks the node after prev, or the head when prev is NULL. */
+void
+list_remove(List *list, ListNode *prev)
+{
+  ListNode *node = prev ? prev->next : list->head;
+  if (prev != NULL) {
+    prev->next = node->next;
+  } else {
+    list->head = node->next;
+  }
+  if (list->tail == node) {
+    list->tail = prev;
+  }
+}
+
 void
 list_size(List *list)
 {
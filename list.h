@@ -11,4 +11,6 @@ typedef struct list {
 } List;
 List *new_list(void);
 void list_append(List *list, const void *value);
+void list_insert(List *list, ListNode *prev, const void *value);
+void list_remove(List *list, ListNode *prev);
 #endif
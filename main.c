@@ -1,19 +1,154 @@
 #include "ast.h"
+#include "lang.h"
 #include "list.h"
+#include "opt.h"
 #include "parse.h"
+#include "pure.h"
+#include "snap.h"
+#include "stats.h"
+#include "types.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int
-main(void)
+/*
+ * With lazy set, fn bodies are skipped while parsing and only those that
+ * the program can call are parsed before the passes run; the others keep
+ * a NULL block, which the passes leave alone.
+ */
+static Node *
+compile(const char *filepath, LineTable **lines, int lazy)
+{
+	Lexer *lexer = new_lexer(filepath);
+	if (lexer == NULL) {
+		return NULL;
+	}
+	long start = STATS_START();
+	Parser *parser = new_parser(lexer);
+	parser->lazy = lazy;
+	Node *node = parser_block(parser);
+	if (lazy) {
+		parser_resolve(parser, node);
+	}
+	STATS_STOP(STATS_PARSE, start);
+	*lines = lexer->lines;
+	stats.ns[STATS_PARSE] -= stats.ns[STATS_LEX];
+	const char *parsedebug = getenv("PARSEDEBUG");
+	if (parsedebug && strcmp(parsedebug, "")) {
+		fprintf(stderr, "%s\n", node_str(node));
+	}
+	start = STATS_START();
+	pure_analyze(node);
+	STATS_STOP(STATS_PURE, start);
+	start = STATS_START();
+	type_analyze(node, lexer);
+	STATS_STOP(STATS_TYPES, start);
+	start = STATS_START();
+	opt_optimize(node);
+	STATS_STOP(STATS_OPT, start);
+	return node;
+}
+
+/*
+ * --check parses each file in recovery mode and prints one
+ * "file:line:column: message" line per error instead of stopping at the
+ * first, so a whole corpus can be validated in one process.
+ */
+static int
+check(const char *filepath)
 {
-	Lexer *lexer = new_lexer("1.txt");
+	Arena *arena = new_arena(65536, 0);
+	Arena *prev = arena_use(arena);
+	Lexer *lexer = new_lexer(filepath);
+	if (lexer == NULL) {
+		printf("%s:0:0: cannot open file\n", filepath);
+		arena_use(prev);
+		arena_free(arena);
+		return 1;
+	}
+	lexer->recovery = 1;
 	Parser *parser = new_parser(lexer);
 	Node *node = parser_block(parser);
 	const char *parsedebug = getenv("PARSEDEBUG");
 	if (parsedebug && strcmp(parsedebug, "")) {
-		//fprintf(stderr, "%s\n", node);
+		fprintf(stderr, "%s\n", node_str(node));
+	}
+	int i, nerrors = lexer->nerrors;
+	for (i = 0; i < nerrors; i++) {
+		printf("%s:%d:%d: %s\n", filepath, lexer->errors[i].line, lexer->errors[i].column,
+		    lexer->errors[i].message);
+	}
+	parser_close(parser);
+	lexer_close(lexer);
+	arena_free(lexer->arena);
+	arena_use(prev);
+	arena_free(arena);
+	return nerrors;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *filepath = "1.txt", *save = NULL, *load = NULL;
+	LangProgram program = {NULL};
+	LangError error;
+	int i, hashcons = 0, lazy = 0, checking = 0, failed = 0;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--check")) {
+			checking = 1;
+		} else if (!strcmp(argv[i], "--stats")) {
+#ifdef NSTATS
+			fprintf(stderr, "--stats: statistics are compiled out\n");
+			return 1;
+#else
+			stats.enabled = 1;
+#endif
+		} else if (!strcmp(argv[i], "--hashcons")) {
+			hashcons = 1;
+		} else if (!strcmp(argv[i], "--lazy")) {
+			lazy = 1;
+		} else if (!strcmp(argv[i], "--save") && i + 1 < argc) {
+			save = argv[++i];
+		} else if (!strcmp(argv[i], "--load") && i + 1 < argc) {
+			load = argv[++i];
+		} else if (checking) {
+			failed |= check(argv[i]) != 0;
+		} else {
+			filepath = argv[i];
+		}
+	}
+	if (checking) {
+		return failed;
+	}
+	if (load) {
+		long start = STATS_START();
+		LangProgram *loaded = lang_program_load(load, &error);
+		STATS_STOP(STATS_LOAD, start);
+		if (loaded == NULL) {
+			fprintf(stderr, "%s\n", error.message);
+			return 1;
+		}
+		program = *loaded;
+		const char *parsedebug = getenv("PARSEDEBUG");
+		if (parsedebug && strcmp(parsedebug, "")) {
+			fprintf(stderr, "%s\n", node_str((Node *)program.block));
+		}
+	} else {
+		if (hashcons) {
+			ast_cons_use(new_ast_cons());
+		}
+		program.block = compile(filepath, &program.lines, lazy && save == NULL);
+		if (program.block == NULL) {
+			fprintf(stderr, "%s: cannot open file\n", filepath);
+			return 1;
+		}
+	}
+	if (save && !lang_program_save(&program, save, &error)) {
+		fprintf(stderr, "%s\n", error.message);
+		return 1;
+	}
+	if (stats.enabled) {
+		stats_print(stderr);
 	}
 	return 0;
 }
@@ -0,0 +1,881 @@
+#include "ast.h"
+#include "list.h"
+#include "opt.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Tree-level cleanups: statements that follow a return, break or continue
+ * in the same block are dropped, and inside functions a var that is never
+ * read or assigned again is removed when its initializer has no side
+ * effects.
+ *
+ * Two rewrites follow. Common subexpression elimination looks for an
+ * expression that a run of side-effect-free statements computes more
+ * than once while none of its variables change, and computes it once
+ * into a new variable named "cse.N", which no script can spell. The
+ * statements are hash-consed first, so equal expressions are the same
+ * node, and statements over OPT_CSE_NODES nodes are left as they are
+ * to keep the search cheap. Loop-invariant hoisting then moves a var
+ * out of a while body, and on out of enclosing loops in the same
+ * function, when its initializer cannot fail and nothing it passes
+ * calls, writes what the initializer reads or sees the variable. The
+ * moved var stays visible after the loops it left, and a function
+ * called from there could read it by name, so it is also left in place
+ * when its name is already bound where it would go, or when anything
+ * after the loop in that block mentions it or calls.
+ */
+
+#ifndef OPT_CSE_WINDOW
+#define OPT_CSE_WINDOW 32
+#endif
+#ifndef OPT_CSE_NODES
+#define OPT_CSE_NODES 64
+#endif
+
+typedef struct {
+	Node *loop;
+	List *statements;
+	ListNode **prev;
+	int names;
+} OptLoop;
+
+typedef struct {
+	int ncse;
+	OptLoop *loops;
+	int nloops, loopscap;
+	const char **names;
+	int nnames, namescap;
+} Opt;
+
+static int
+opt_pure(Node *node)
+{
+	ListNode *n;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			if (!opt_pure((Node *)n->value)) {
+				return 0;
+			}
+		}
+		return 1;
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_pure(((BooleanExpression *)node->value)->left) &&
+		    opt_pure(((BooleanExpression *)node->value)->right);
+	case AST_LOGICAL_OPERAND:
+		return opt_pure(((LogicalOperand *)node->value)->left) &&
+		    opt_pure(((LogicalOperand *)node->value)->right);
+	case AST_TERM:
+		return opt_pure(((Term *)node->value)->left) &&
+		    opt_pure(((Term *)node->value)->right);
+	case AST_INDEX_EXPRESSION:
+		return opt_pure(((IndexExpression *)node->value)->array) &&
+		    opt_pure(((IndexExpression *)node->value)->index);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_pure(((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_CALL_EXPRESSION:
+		return 0;
+	case AST_BOOLEAN_LITERAL:
+	case AST_IDENTIFIER:
+	case AST_NUMBER_LITERAL:
+	case AST_STRING_LITERAL:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+opt_uses(Node *node, const char *id)
+{
+	ListNode *n;
+	int uses = 0;
+	if (node == NULL) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			uses += opt_uses((Node *)n->value, id);
+		}
+		return uses;
+	case AST_ASSIGNMENT_STATEMENT: {
+		AssignmentStatement *as = (AssignmentStatement *)node->value;
+		return !strcmp(as->id, id) + opt_uses(as->expression, id);
+	}
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			uses += opt_uses((Node *)n->value, id);
+		}
+		return uses;
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_uses(((BooleanExpression *)node->value)->left, id) +
+		    opt_uses(((BooleanExpression *)node->value)->right, id);
+	case AST_CALL_EXPRESSION:
+		for (n = ((CallExpression *)node->value)->arguments->head; n; n = n->next) {
+			uses += opt_uses((Node *)n->value, id);
+		}
+		return uses;
+	case AST_DECLARATION_STATEMENT:
+		return opt_uses(((DeclarationStatement *)node->value)->expression, id);
+	case AST_FUNCTION_STATEMENT:
+		return opt_uses(((FunctionStatement *)node->value)->block, id);
+	case AST_IDENTIFIER:
+		return !strcmp(((Identifier *)node->value)->value, id);
+	case AST_IF_STATEMENT:
+		return opt_uses(((IfStatement *)node->value)->booleanExpression, id) +
+		    opt_uses(((IfStatement *)node->value)->block, id);
+	case AST_INDEX_EXPRESSION:
+		return opt_uses(((IndexExpression *)node->value)->array, id) +
+		    opt_uses(((IndexExpression *)node->value)->index, id);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_uses(((LogicalNotExpression *)node->value)->booleanExpression, id);
+	case AST_LOGICAL_OPERAND:
+		return opt_uses(((LogicalOperand *)node->value)->left, id) +
+		    opt_uses(((LogicalOperand *)node->value)->right, id);
+	case AST_PRINT_STATEMENT:
+		return opt_uses(((PrintStatement *)node->value)->expression, id);
+	case AST_RETURN_STATEMENT:
+		return opt_uses(((ReturnStatement *)node->value)->expression, id);
+	case AST_SPAWN_STATEMENT:
+		return opt_uses(((SpawnStatement *)node->value)->callExpression, id);
+	case AST_TERM:
+		return opt_uses(((Term *)node->value)->left, id) +
+		    opt_uses(((Term *)node->value)->right, id);
+	case AST_WHILE_STATEMENT:
+		return opt_uses(((WhileStatement *)node->value)->booleanExpression, id) +
+		    opt_uses(((WhileStatement *)node->value)->block, id);
+	default:
+		return 0;
+	}
+}
+
+static int
+opt_dead(Node *node, Node *function)
+{
+	if (node == NULL) {
+		return 1;
+	}
+	if (node->type == AST_DECLARATION_STATEMENT && function != NULL) {
+		DeclarationStatement *ds = (DeclarationStatement *)node->value;
+		return opt_pure(ds->expression) &&
+		    !opt_uses(((FunctionStatement *)function->value)->block, ds->id);
+	}
+	return 0;
+}
+
+static void
+opt_block(Node *node, Node *function)
+{
+	Block *b = (Block *)node->value;
+	List *statements = new_list();
+	ListNode *n;
+	for (n = b->statements->head; n; n = n->next) {
+		Node *s = (Node *)n->value;
+		if (opt_dead(s, function)) {
+			continue;
+		}
+		list_append(statements, s);
+		switch (s->type) {
+		case AST_FUNCTION_STATEMENT:
+			if (((FunctionStatement *)s->value)->block) {
+				opt_block(((FunctionStatement *)s->value)->block, s);
+			}
+			break;
+		case AST_IF_STATEMENT:
+			opt_block(((IfStatement *)s->value)->block, function);
+			break;
+		case AST_WHILE_STATEMENT:
+			opt_block(((WhileStatement *)s->value)->block, function);
+			break;
+		default:
+			break;
+		}
+		if (s->type == AST_RETURN_STATEMENT ||
+		    s->type == AST_BREAK_STATEMENT ||
+		    s->type == AST_CONTINUE_STATEMENT) {
+			break;
+		}
+	}
+	b->statements = statements;
+}
+
+static int
+opt_writes(Node *node, const char *id)
+{
+	ListNode *n;
+	int writes = 0;
+	if (node == NULL) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_ASSIGNMENT_STATEMENT:
+		return !strcmp(((AssignmentStatement *)node->value)->id, id);
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			writes += opt_writes((Node *)n->value, id);
+		}
+		return writes;
+	case AST_DECLARATION_STATEMENT:
+		return !strcmp(((DeclarationStatement *)node->value)->id, id);
+	case AST_FUNCTION_STATEMENT:
+		return opt_writes(((FunctionStatement *)node->value)->block, id);
+	case AST_IF_STATEMENT:
+		return opt_writes(((IfStatement *)node->value)->block, id);
+	case AST_WHILE_STATEMENT:
+		return opt_writes(((WhileStatement *)node->value)->block, id);
+	default:
+		return 0;
+	}
+}
+
+/* Whether an expression or simple statement may call, spawn or join, after which any variable may have changed. */
+static int
+opt_calls(Node *node)
+{
+	ListNode *n;
+	if (node == NULL) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_CALL_EXPRESSION:
+	case AST_JOIN_STATEMENT:
+	case AST_SPAWN_STATEMENT:
+		return 1;
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			if (opt_calls((Node *)n->value)) {
+				return 1;
+			}
+		}
+		return 0;
+	case AST_ASSIGNMENT_STATEMENT:
+		return opt_calls(((AssignmentStatement *)node->value)->expression);
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_calls(((BooleanExpression *)node->value)->left) ||
+		    opt_calls(((BooleanExpression *)node->value)->right);
+	case AST_DECLARATION_STATEMENT:
+		return opt_calls(((DeclarationStatement *)node->value)->expression);
+	case AST_INDEX_EXPRESSION:
+		return opt_calls(((IndexExpression *)node->value)->array) ||
+		    opt_calls(((IndexExpression *)node->value)->index);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_calls(((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_LOGICAL_OPERAND:
+		return opt_calls(((LogicalOperand *)node->value)->left) ||
+		    opt_calls(((LogicalOperand *)node->value)->right);
+	case AST_PRINT_STATEMENT:
+		return opt_calls(((PrintStatement *)node->value)->expression);
+	case AST_RETURN_STATEMENT:
+		return opt_calls(((ReturnStatement *)node->value)->expression);
+	case AST_TERM:
+		return opt_calls(((Term *)node->value)->left) ||
+		    opt_calls(((Term *)node->value)->right);
+	default:
+		return 0;
+	}
+}
+
+/* Rebuilds an expression through the constructors, so that with a cons table installed equal subtrees become one node. */
+static Node *
+opt_intern(Node *node)
+{
+	switch (node->type) {
+	case AST_ARRAY_LITERAL: {
+		List *elements = new_list();
+		ListNode *n;
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			list_append(elements, opt_intern((Node *)n->value));
+		}
+		return new_array_literal(elements);
+	}
+	case AST_BOOLEAN_EXPRESSION: {
+		BooleanExpression *be = (BooleanExpression *)node->value;
+		return new_boolean_expression(opt_intern(be->left), be->operator, opt_intern(be->right));
+	}
+	case AST_BOOLEAN_LITERAL:
+		return new_boolean_literal(((BooleanLiteral *)node->value)->value);
+	case AST_IDENTIFIER:
+		return new_identifier(((Identifier *)node->value)->value);
+	case AST_INDEX_EXPRESSION: {
+		IndexExpression *ie = (IndexExpression *)node->value;
+		return new_index_expression(opt_intern(ie->array), opt_intern(ie->index));
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return new_logical_not_expression(opt_intern(((LogicalNotExpression *)node->value)->booleanExpression));
+	case AST_LOGICAL_OPERAND: {
+		LogicalOperand *lo = (LogicalOperand *)node->value;
+		return new_logical_operand(opt_intern(lo->left), lo->operator, opt_intern(lo->right));
+	}
+	case AST_NUMBER_LITERAL:
+		return new_number_literal(((NumberLiteral *)node->value)->value);
+	case AST_STRING_LITERAL:
+		return new_string_literal(((StringLiteral *)node->value)->value);
+	case AST_TERM: {
+		Term *t = (Term *)node->value;
+		return new_term(opt_intern(t->left), t->operator, opt_intern(t->right));
+	}
+	default:
+		return node;
+	}
+}
+
+static int
+opt_occurs(Node *node, Node *e)
+{
+	ListNode *n;
+	int count = 0;
+	if (node == e) {
+		return 1;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			count += opt_occurs((Node *)n->value, e);
+		}
+		return count;
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_occurs(((BooleanExpression *)node->value)->left, e) +
+		    opt_occurs(((BooleanExpression *)node->value)->right, e);
+	case AST_INDEX_EXPRESSION:
+		return opt_occurs(((IndexExpression *)node->value)->array, e) +
+		    opt_occurs(((IndexExpression *)node->value)->index, e);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_occurs(((LogicalNotExpression *)node->value)->booleanExpression, e);
+	case AST_LOGICAL_OPERAND:
+		return opt_occurs(((LogicalOperand *)node->value)->left, e) +
+		    opt_occurs(((LogicalOperand *)node->value)->right, e);
+	case AST_TERM:
+		return opt_occurs(((Term *)node->value)->left, e) +
+		    opt_occurs(((Term *)node->value)->right, e);
+	default:
+		return 0;
+	}
+}
+
+static Node *
+opt_replace(Node *node, Node *e, Node *id)
+{
+	if (node == e) {
+		return id;
+	}
+	if (!opt_occurs(node, e)) {
+		return node;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL: {
+		List *elements = new_list();
+		ListNode *n;
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			list_append(elements, opt_replace((Node *)n->value, e, id));
+		}
+		return new_array_literal(elements);
+	}
+	case AST_BOOLEAN_EXPRESSION: {
+		BooleanExpression *be = (BooleanExpression *)node->value;
+		return new_boolean_expression(opt_replace(be->left, e, id), be->operator,
+		    opt_replace(be->right, e, id));
+	}
+	case AST_INDEX_EXPRESSION: {
+		IndexExpression *ie = (IndexExpression *)node->value;
+		return new_index_expression(opt_replace(ie->array, e, id), opt_replace(ie->index, e, id));
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return new_logical_not_expression(
+		    opt_replace(((LogicalNotExpression *)node->value)->booleanExpression, e, id));
+	case AST_LOGICAL_OPERAND: {
+		LogicalOperand *lo = (LogicalOperand *)node->value;
+		return new_logical_operand(opt_replace(lo->left, e, id), lo->operator,
+		    opt_replace(lo->right, e, id));
+	}
+	case AST_TERM: {
+		Term *t = (Term *)node->value;
+		return new_term(opt_replace(t->left, e, id), t->operator, opt_replace(t->right, e, id));
+	}
+	default:
+		return node;
+	}
+}
+
+/* The expression slot of a var, assignment, print or return, or NULL for other statements. */
+static Node **
+opt_expression(Node *s)
+{
+	if (s == NULL) {
+		return NULL;
+	}
+	switch (s->type) {
+	case AST_ASSIGNMENT_STATEMENT:
+		return &((AssignmentStatement *)s->value)->expression;
+	case AST_DECLARATION_STATEMENT:
+		return &((DeclarationStatement *)s->value)->expression;
+	case AST_PRINT_STATEMENT:
+		return &((PrintStatement *)s->value)->expression;
+	case AST_RETURN_STATEMENT:
+		return &((ReturnStatement *)s->value)->expression;
+	default:
+		return NULL;
+	}
+}
+
+/* Whether an expression has at most *budget nodes, taking them from the budget. */
+static int
+opt_small(Node *node, int *budget)
+{
+	ListNode *n;
+	if (--*budget < 0) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			if (!opt_small((Node *)n->value, budget)) {
+				return 0;
+			}
+		}
+		return 1;
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_small(((BooleanExpression *)node->value)->left, budget) &&
+		    opt_small(((BooleanExpression *)node->value)->right, budget);
+	case AST_CALL_EXPRESSION:
+		for (n = ((CallExpression *)node->value)->arguments->head; n; n = n->next) {
+			if (!opt_small((Node *)n->value, budget)) {
+				return 0;
+			}
+		}
+		return 1;
+	case AST_INDEX_EXPRESSION:
+		return opt_small(((IndexExpression *)node->value)->array, budget) &&
+		    opt_small(((IndexExpression *)node->value)->index, budget);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_small(((LogicalNotExpression *)node->value)->booleanExpression, budget);
+	case AST_LOGICAL_OPERAND:
+		return opt_small(((LogicalOperand *)node->value)->left, budget) &&
+		    opt_small(((LogicalOperand *)node->value)->right, budget);
+	case AST_TERM:
+		return opt_small(((Term *)node->value)->left, budget) &&
+		    opt_small(((Term *)node->value)->right, budget);
+	default:
+		return 1;
+	}
+}
+
+static int
+opt_simple(Node *s)
+{
+	Node **slot = opt_expression(s);
+	int budget = OPT_CSE_NODES;
+	return slot && *slot && opt_small(*slot, &budget) && opt_pure(*slot);
+}
+
+/*
+ * Counts the occurrences of e from statement n on, and replaces them
+ * with id when id is set. The run ends at the first statement that is
+ * not simple, after a return, after one that assigns or declares a
+ * variable e reads, or after OPT_CSE_WINDOW statements.
+ */
+static int
+opt_cse_window(ListNode *n, Node *e, Node *id)
+{
+	int i, count = 0;
+	for (i = 0; n && i < OPT_CSE_WINDOW && opt_simple((Node *)n->value); n = n->next, i++) {
+		Node *s = (Node *)n->value;
+		Node **slot = opt_expression(s);
+		count += opt_occurs(*slot, e);
+		if (id) {
+			*slot = opt_replace(*slot, e, id);
+		}
+		if (s->type == AST_RETURN_STATEMENT ||
+		    (s->type == AST_ASSIGNMENT_STATEMENT &&
+		    opt_uses(e, ((AssignmentStatement *)s->value)->id)) ||
+		    (s->type == AST_DECLARATION_STATEMENT &&
+		    opt_uses(e, ((DeclarationStatement *)s->value)->id))) {
+			break;
+		}
+	}
+	return count;
+}
+
+/*
+ * Finds the largest subexpression of statement n's expression that the
+ * window computes at least twice. Only places that are always evaluated
+ * are searched, so the right operand of "and" and "or" is skipped.
+ */
+static Node *
+opt_cse_candidate(ListNode *n, Node *node)
+{
+	Node *found;
+	ListNode *e;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (e = ((ArrayLiteral *)node->value)->elements->head; e; e = e->next) {
+			if ((found = opt_cse_candidate(n, (Node *)e->value)) != NULL) {
+				return found;
+			}
+		}
+		return NULL;
+	case AST_BOOLEAN_EXPRESSION: {
+		BooleanExpression *be = (BooleanExpression *)node->value;
+		if (opt_cse_window(n, node, NULL) > 1) {
+			return node;
+		}
+		if ((found = opt_cse_candidate(n, be->left)) != NULL) {
+			return found;
+		}
+		if (!strcmp(be->operator, "and") || !strcmp(be->operator, "or")) {
+			return NULL;
+		}
+		return opt_cse_candidate(n, be->right);
+	}
+	case AST_INDEX_EXPRESSION: {
+		IndexExpression *ie = (IndexExpression *)node->value;
+		if (opt_cse_window(n, node, NULL) > 1) {
+			return node;
+		}
+		if ((found = opt_cse_candidate(n, ie->array)) != NULL) {
+			return found;
+		}
+		return opt_cse_candidate(n, ie->index);
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		if (opt_cse_window(n, node, NULL) > 1) {
+			return node;
+		}
+		return opt_cse_candidate(n, ((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_LOGICAL_OPERAND: {
+		LogicalOperand *lo = (LogicalOperand *)node->value;
+		if (opt_cse_window(n, node, NULL) > 1) {
+			return node;
+		}
+		if ((found = opt_cse_candidate(n, lo->left)) != NULL) {
+			return found;
+		}
+		return opt_cse_candidate(n, lo->right);
+	}
+	case AST_TERM: {
+		Term *t = (Term *)node->value;
+		if (opt_cse_window(n, node, NULL) > 1) {
+			return node;
+		}
+		if ((found = opt_cse_candidate(n, t->left)) != NULL) {
+			return found;
+		}
+		return opt_cse_candidate(n, t->right);
+	}
+	default:
+		return NULL;
+	}
+}
+
+static void
+opt_cse(Opt *opt, Node *block)
+{
+	List *statements = ((Block *)block->value)->statements;
+	ListNode *n, *prev = NULL;
+	for (n = statements->head; n; n = n->next) {
+		Node *s = (Node *)n->value;
+		if (opt_simple(s)) {
+			Node **slot = opt_expression(s);
+			*slot = opt_intern(*slot);
+		}
+	}
+	for (n = statements->head; n; prev = n, n = n->next) {
+		Node *s = (Node *)n->value;
+		Node *e;
+		if (s == NULL) {
+			continue;
+		}
+		switch (s->type) {
+		case AST_FUNCTION_STATEMENT:
+			if (((FunctionStatement *)s->value)->block) {
+				opt_cse(opt, ((FunctionStatement *)s->value)->block);
+			}
+			break;
+		case AST_IF_STATEMENT:
+			opt_cse(opt, ((IfStatement *)s->value)->block);
+			break;
+		case AST_WHILE_STATEMENT:
+			opt_cse(opt, ((WhileStatement *)s->value)->block);
+			break;
+		default:
+			while (opt_simple(s) && (e = opt_cse_candidate(n, *opt_expression(s))) != NULL) {
+				char *name = STATS_ALLOC(STATS_AST, 16);
+				snprintf(name, 16, "cse.%d", ++opt->ncse);
+				opt_cse_window(n, e, new_identifier(name));
+				list_insert(statements, prev, new_declaration_statement(name, e));
+				prev = prev ? prev->next : statements->head;
+			}
+			break;
+		}
+	}
+}
+
+/* An initializer that cannot fail or have effects: no calls, division or indexing. */
+static int
+opt_safe(Node *node)
+{
+	ListNode *n;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			if (!opt_safe((Node *)n->value)) {
+				return 0;
+			}
+		}
+		return 1;
+	case AST_BOOLEAN_EXPRESSION:
+		return opt_safe(((BooleanExpression *)node->value)->left) &&
+		    opt_safe(((BooleanExpression *)node->value)->right);
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return opt_safe(((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_LOGICAL_OPERAND:
+		return opt_safe(((LogicalOperand *)node->value)->left) &&
+		    opt_safe(((LogicalOperand *)node->value)->right);
+	case AST_TERM:
+		return strcmp(((Term *)node->value)->operator, "/") &&
+		    opt_safe(((Term *)node->value)->left) &&
+		    opt_safe(((Term *)node->value)->right);
+	case AST_BOOLEAN_LITERAL:
+	case AST_IDENTIFIER:
+	case AST_NUMBER_LITERAL:
+	case AST_STRING_LITERAL:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Whether node, leaving out the subtree skip, may call, writes a
+ * variable that expression reads, or mentions id when it is set.
+ * Function definitions only count for id, since they run when called.
+ */
+static int
+opt_clobbers(Node *node, Node *skip, Node *expression, const char *id)
+{
+	ListNode *n;
+	if (node == NULL || node == skip) {
+		return 0;
+	}
+	switch (node->type) {
+	case AST_ASSIGNMENT_STATEMENT: {
+		AssignmentStatement *as = (AssignmentStatement *)node->value;
+		return opt_calls(as->expression) || opt_uses(expression, as->id) ||
+		    (id && opt_uses(node, id));
+	}
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			if (opt_clobbers((Node *)n->value, skip, expression, id)) {
+				return 1;
+			}
+		}
+		return 0;
+	case AST_BREAK_STATEMENT:
+	case AST_CONTINUE_STATEMENT:
+		return 0;
+	case AST_DECLARATION_STATEMENT: {
+		DeclarationStatement *ds = (DeclarationStatement *)node->value;
+		return opt_calls(ds->expression) || opt_uses(expression, ds->id) ||
+		    (id && (!strcmp(ds->id, id) || opt_uses(node, id)));
+	}
+	case AST_FUNCTION_STATEMENT:
+		return id && (opt_uses(node, id) || opt_writes(node, id));
+	case AST_IF_STATEMENT: {
+		IfStatement *is = (IfStatement *)node->value;
+		return opt_calls(is->booleanExpression) || (id && opt_uses(is->booleanExpression, id)) ||
+		    opt_clobbers(is->block, skip, expression, id);
+	}
+	case AST_WHILE_STATEMENT: {
+		WhileStatement *ws = (WhileStatement *)node->value;
+		return opt_calls(ws->booleanExpression) || (id && opt_uses(ws->booleanExpression, id)) ||
+		    opt_clobbers(ws->block, skip, expression, id);
+	}
+	default:
+		return opt_calls(node) || (id && opt_uses(node, id));
+	}
+}
+
+/* Whether a statement after loop in its enclosing list mentions id or may call. */
+static int
+opt_after(OptLoop *loop, const char *id)
+{
+	ListNode *n = *loop->prev ? (*loop->prev)->next : loop->statements->head;
+	for (n = n->next; n; n = n->next) {
+		if (opt_clobbers((Node *)n->value, NULL, NULL, id) || opt_writes((Node *)n->value, id)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The scope and loop stacks come from the arena, like the tree they
+ * describe, so nothing is left behind when the arena limit unwinds the
+ * pass. Growing copies and abandons the old array.
+ */
+static void *
+opt_grow(void *old, int len, int *cap, size_t size)
+{
+	void *p;
+	*cap = *cap ? *cap * 2 : 16;
+	p = STATS_ALLOC(STATS_AST, *cap * size);
+	if (len) {
+		memcpy(p, old, len * size);
+	}
+	return p;
+}
+
+static void
+opt_bind(Opt *opt, const char *name)
+{
+	if (opt->nnames == opt->namescap) {
+		opt->names = opt_grow(opt->names, opt->nnames, &opt->namescap, sizeof *opt->names);
+	}
+	opt->names[opt->nnames++] = name;
+}
+
+/* Whether name is a var or parameter in scope in front of loop. */
+static int
+opt_bound(Opt *opt, OptLoop *loop, const char *name)
+{
+	int i;
+	for (i = loop->names - 1; i >= 0; i--) {
+		if (!strcmp(opt->names[i], name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Where the var in node n of the innermost open loop's body can go: the
+ * index in opt->loops of the outermost loop, no further out than base,
+ * that it can be moved in front of, or -1 to leave it. The initializer
+ * must be safe, the variable set only by this var and not used before
+ * it, and each loop passed must neither call, write what the
+ * initializer reads nor mention the variable outside the loop left.
+ * Where it lands, its name must be unbound and unused after the loop.
+ */
+static int
+opt_level(Opt *opt, int base, ListNode *n)
+{
+	int top = opt->nloops - 1, level;
+	WhileStatement *ws = (WhileStatement *)opt->loops[top].loop->value;
+	Node *s = (Node *)n->value;
+	ListNode *m;
+	if (s == NULL || s->type != AST_DECLARATION_STATEMENT) {
+		return -1;
+	}
+	DeclarationStatement *ds = (DeclarationStatement *)s->value;
+	if (!opt_safe(ds->expression) || opt_writes(ws->block, ds->id) != 1 ||
+	    opt_uses(ws->booleanExpression, ds->id) ||
+	    opt_clobbers(opt->loops[top].loop, NULL, ds->expression, NULL)) {
+		return -1;
+	}
+	for (m = ((Block *)ws->block->value)->statements->head; m != n; m = m->next) {
+		if (opt_uses((Node *)m->value, ds->id)) {
+			return -1;
+		}
+	}
+	for (level = top; level > base &&
+	    !opt_clobbers(opt->loops[level - 1].loop, opt->loops[level].loop, ds->expression, ds->id);
+	    level--)
+		;
+	for (; level <= top && (opt_bound(opt, &opt->loops[level], ds->id) ||
+	    opt_after(&opt->loops[level], ds->id)); level++)
+		;
+	return level <= top ? level : -1;
+}
+
+/* Moves each var of the innermost open loop's body that opt_level places out of the loop. */
+static void
+opt_hoist(Opt *opt, int base)
+{
+	Node *body = ((WhileStatement *)opt->loops[opt->nloops - 1].loop->value)->block;
+	List *list = ((Block *)body->value)->statements;
+	ListNode *n, *before = NULL;
+	for (n = list->head; n; n = before ? before->next : list->head) {
+		int level = opt_level(opt, base, n);
+		if (level < 0) {
+			before = n;
+			continue;
+		}
+		OptLoop *loop = &opt->loops[level];
+		list_remove(list, before);
+		list_insert(loop->statements, *loop->prev, n->value);
+		*loop->prev = *loop->prev ? (*loop->prev)->next : loop->statements->head;
+	}
+}
+
+/* Hoists out of every while in block, innermost first. base is the first loop of the enclosing function. */
+static void
+opt_licm(Opt *opt, Node *block, int base)
+{
+	List *statements = ((Block *)block->value)->statements;
+	ListNode *n, *p, *prev = NULL;
+	int names = opt->nnames;
+	for (n = statements->head; n; prev = n, n = n->next) {
+		Node *s = (Node *)n->value;
+		if (s == NULL) {
+			continue;
+		}
+		switch (s->type) {
+		case AST_DECLARATION_STATEMENT:
+			opt_bind(opt, ((DeclarationStatement *)s->value)->id);
+			break;
+		case AST_FUNCTION_STATEMENT:
+			if (((FunctionStatement *)s->value)->block) {
+				int len = opt->nnames;
+				for (p = ((FunctionStatement *)s->value)->parameters->head; p; p = p->next) {
+					opt_bind(opt, p->value);
+				}
+				opt_licm(opt, ((FunctionStatement *)s->value)->block, opt->nloops);
+				opt->nnames = len;
+			}
+			break;
+		case AST_IF_STATEMENT:
+			opt_licm(opt, ((IfStatement *)s->value)->block, base);
+			break;
+		case AST_WHILE_STATEMENT:
+			if (opt->nloops == opt->loopscap) {
+				opt->loops = opt_grow(opt->loops, opt->nloops, &opt->loopscap,
+				    sizeof *opt->loops);
+			}
+			opt->loops[opt->nloops].loop = s;
+			opt->loops[opt->nloops].statements = statements;
+			opt->loops[opt->nloops].prev = &prev;
+			opt->loops[opt->nloops].names = opt->nnames;
+			opt->nloops++;
+			opt_licm(opt, ((WhileStatement *)s->value)->block, base);
+			opt_hoist(opt, base);
+			opt->nloops--;
+			break;
+		default:
+			break;
+		}
+	}
+	opt->nnames = names;
+}
+
+void
+opt_optimize(Node *block)
+{
+	Opt opt = {0, NULL, 0, 0, NULL, 0, 0};
+	AstCons *prev = ast_cons_use(NULL);
+	AstCons *cons = prev ? prev : new_ast_cons();
+	opt_block(block, NULL);
+	ast_cons_use(cons);
+	opt_cse(&opt, block);
+	ast_cons_use(prev);
+	if (cons != prev) {
+		ast_cons_free(cons);
+	}
+	opt_licm(&opt, block, 0);
+	const char *optdebug = getenv("OPTDEBUG");
+	if (optdebug && strcmp(optdebug, "")) {
+		fprintf(stderr, "%s\n", node_str(block));
+	}
+}
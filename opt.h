@@ -0,0 +1,5 @@
+#ifndef OPT_H
+#define OPT_H 1
+#include "ast.h"
+void opt_optimize(Node *block);
+#endif
@@ -1,19 +1,114 @@
 #include "ast.h"
 #include "lex.h"
 #include "parse.h"
+#include "stats.h"
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * The parser keeps its nesting on two heap-allocated stacks in Parser
+ * instead of the C stack. parser_block holds one frame per open if,
+ * while or fn body, and parser_expression is an operator-precedence
+ * parser whose operator stack also records open parentheses, call
+ * argument lists, array literals and index brackets. The parser_*
+ * entry points of the old recursive descent remain and differ only in
+ * the lowest precedence they accept.
+ *
+ * The passes after the parser still recurse over the tree, so the parser
+ * also bounds how deep the tree gets. Each block frame adds two levels,
+ * the statement and its block, and each operand carries the height of
+ * its subtree. Anything deeper than maxdepth levels, counted from the
+ * root block, is an error. The default of PARSER_MAX_DEPTH keeps every
+ * pass, node_str and snapshot saving within a 1 MiB stack. A lazy fn
+ * records its depth so that its body is counted from there when it is
+ * parsed later.
+ */
+
+enum {
+	PREC_OR = 1,
+	PREC_AND,
+	PREC_CONDITION,
+	PREC_OPERAND,
+	PREC_TERM,
+	PREC_NOT,
+	PREC_ATOM
+};
+
+enum {
+	PARSER_BINARY,
+	PARSER_NOT,
+	PARSER_PAREN,
+	PARSER_CALL,
+	PARSER_ARRAY,
+	PARSER_INDEX
+};
+
+struct parser_frame {
+	AstType type;
+	List *statements;
+	Node *booleanExpression;
+	const char *name;
+	List *parameters;
+	uint32_t offset;
+};
+
+struct parser_operator {
+	int kind;
+	int prec;
+	const char *operator;
+	List *arguments;
+	int height;
+	uint32_t offset;
+};
+
+static Token *
+parser_lex(Lexer *lexer)
+{
+	long start = STATS_START();
+	Token *token = lexer_lex(lexer);
+	STATS_STOP(STATS_LEX, start);
+	return token;
+}
+
 Parser *
 new_parser(Lexer *lexer)
 {
-	Parser *parser = malloc(sizeof *parser);
+	Parser *parser = STATS_ALLOC(STATS_PARSER, sizeof *parser);
 	parser->lexer = lexer;
-	parser->token = lexer_lex(lexer);
+	parser->token = parser_lex(lexer);
+	parser->prev = NULL;
+	parser->maxdepth = PARSER_MAX_DEPTH;
+	parser->depth = 0;
+	parser->lazy = 0;
+	parser->frames = NULL;
+	parser->nframes = parser->framescap = 0;
+	parser->operators = NULL;
+	parser->noperators = parser->operatorscap = 0;
+	parser->operands = NULL;
+	parser->heights = NULL;
+	parser->noperands = parser->operandscap = 0;
 	return parser;
 }
 
+void
+parser_close(Parser *p)
+{
+	free(p->frames);
+	free(p->operators);
+	free(p->operands);
+	free(p->heights);
+}
+
+static void
+parser_nesting(Parser *p, int depth)
+{
+	if (depth > p->maxdepth) {
+		lexer_error(p->lexer, p->token->offset, "nesting deeper than %d levels", p->maxdepth);
+	}
+}
+
 int
 parser_accept(Parser *p, const char *expected)
 {
@@ -24,25 +119,177 @@ const char *
 parser_expect(Parser *p, const char *expected)
 {
 	if (strcmp(p->token->symbol, expected)) {
-		fprintf(stderr, "expected '%s', got '%s' at line %d, column %d\n", expected, p->token->symbol, p->token->line, p->token->column);
-		exit(1);
+		lexer_error(p->lexer, p->token->offset, "expected '%s', got '%s'", expected, p->token->symbol);
 	}
-	const char *symbol = p->token->symbol;
 	const char *value = p->token->value;
-	p->token = lexer_lex(p->lexer);
+	p->prev = p->token;
+	p->token = parser_lex(p->lexer);
 	return value;
 }
 
+static struct parser_frame *
+parser_push_frame(Parser *p, AstType type)
+{
+	parser_nesting(p, p->depth + 2 * p->nframes + 1);
+	if (p->nframes == p->framescap) {
+		p->framescap = p->framescap ? p->framescap * 2 : 16;
+		p->frames = realloc(p->frames, p->framescap * sizeof *p->frames);
+	}
+	struct parser_frame *f = &p->frames[p->nframes++];
+	f->type = type;
+	f->statements = new_list();
+	f->booleanExpression = NULL;
+	f->name = NULL;
+	f->parameters = NULL;
+	return f;
+}
+
+static void
+parser_function_header(Parser *p, struct parser_frame *f)
+{
+	f->parameters = new_list();
+	f->offset = p->token->offset;
+	parser_expect(p, "fn");
+	f->name = parser_expect(p, "id");
+	parser_expect(p, "(");
+	if (parser_accept(p, "id")) {
+		list_append(f->parameters, parser_expect(p, "id"));
+		while (1) {
+			if (!parser_accept(p, ",")) {
+				break;
+			}
+			parser_expect(p, ",");
+			list_append(f->parameters, parser_expect(p, "id"));
+		}
+	}
+	parser_expect(p, ")");
+	parser_expect(p, "{");
+}
+
+static void
+parser_pop_frame(Parser *p)
+{
+	struct parser_frame *f = &p->frames[p->nframes - 1];
+	Node *block = new_block(f->statements);
+	Node *node;
+	if (f->type == AST_IF_STATEMENT) {
+		node = new_if_statement(f->booleanExpression, block);
+	} else if (f->type == AST_WHILE_STATEMENT) {
+		node = new_while_statement(f->booleanExpression, block);
+	} else {
+		node = new_function_statement(f->name, f->parameters, block, f->offset);
+	}
+	p->nframes--;
+	list_append(p->frames[p->nframes - 1].statements, node);
+}
+
+/*
+ * In lazy mode a fn body is not parsed where it is defined. Its span is
+ * skipped with lexer_skip_block and kept as the offsets of its first
+ * token and of its closing '}', and the block is left NULL until
+ * parser_function_block parses it from the same lexer and checks that
+ * the parse ends at that same '}'.
+ */
+static Node *
+parser_lazy_function(Parser *p, struct parser_frame *header)
+{
+	uint32_t body = p->token->offset;
+	if (!parser_accept(p, "}")) {
+		long start = STATS_START();
+		lexer_skip_block(p->lexer, parser_accept(p, "{") ? 2 : 1);
+		STATS_STOP(STATS_LEX, start);
+		p->prev = p->token;
+		p->token = parser_lex(p->lexer);
+	}
+	Node *node = new_function_statement(header->name, header->parameters, NULL, header->offset);
+	FunctionStatement *fs = (FunctionStatement *)node->value;
+	fs->body = body;
+	fs->end = p->token->offset;
+	fs->depth = p->depth + 2 * p->nframes;
+	parser_expect(p, "}");
+	return node;
+}
+
+/*
+ * Panic-mode recovery: after an error inside parser_block, drop the
+ * half-parsed statement and skip tokens up to and including the next
+ * ';', or up to the '}' that closes an open frame. At end of input the
+ * open frames are closed as they stand, so the tree keeps every
+ * statement that did parse.
+ */
+static void
+parser_synchronize(Parser *p, int base)
+{
+	while (1) {
+		if (parser_accept(p, ";")) {
+			parser_expect(p, ";");
+			return;
+		} else if (parser_accept(p, "}") && (p->nframes > base + 1 || base > 0)) {
+			return;
+		} else if (parser_accept(p, "eof")) {
+			while (p->nframes > base + 1) {
+				parser_pop_frame(p);
+			}
+			return;
+		}
+		p->prev = p->token;
+		p->token = parser_lex(p->lexer);
+	}
+}
+
 Node *
 parser_block(Parser *p)
 {
-	List *statements = new_list();
-	while (!parser_accept(p, "eof") && !parser_accept(p, "}")) {
-		list_append(statements, parser_statement(p));
+	jmp_buf recover, *prev = p->lexer->recover;
+	int base = p->nframes;
+	int noperators = p->noperators, noperands = p->noperands;
+	struct parser_frame *f = parser_push_frame(p, AST_BLOCK);
+	if (p->lexer->recovery) {
+		p->lexer->recover = &recover;
+		if (setjmp(recover)) {
+			p->noperators = noperators;
+			p->noperands = noperands;
+			parser_synchronize(p, base);
+		}
 	}
-	Block *block = malloc(sizeof *block);
-	block->statements = statements;
-	return new_node(AST_BLOCK, block);
+	while (1) {
+		f = &p->frames[p->nframes - 1];
+		if (parser_accept(p, "eof") || parser_accept(p, "}")) {
+			if (p->nframes == base + 1) {
+				if (p->lexer->recovery && base == 0 && parser_accept(p, "}")) {
+					lexer_diagnose(p->lexer, p->token->offset, "unexpected '}'");
+					parser_expect(p, "}");
+					continue;
+				}
+				break;
+			}
+			parser_expect(p, "}");
+			parser_pop_frame(p);
+		} else if (parser_accept(p, "if") || parser_accept(p, "while")) {
+			AstType type = parser_accept(p, "if") ? AST_IF_STATEMENT : AST_WHILE_STATEMENT;
+			parser_expect(p, p->token->symbol);
+			Node *be = parser_boolean_expression(p);
+			parser_expect(p, "{");
+			f = parser_push_frame(p, type);
+			f->booleanExpression = be;
+		} else if (parser_accept(p, "fn")) {
+			struct parser_frame header;
+			parser_function_header(p, &header);
+			if (p->lazy) {
+				list_append(f->statements, parser_lazy_function(p, &header));
+				continue;
+			}
+			f = parser_push_frame(p, AST_FUNCTION_STATEMENT);
+			f->name = header.name;
+			f->parameters = header.parameters;
+			f->offset = header.offset;
+		} else {
+			list_append(f->statements, parser_statement(p));
+		}
+	}
+	p->lexer->recover = prev;
+	p->nframes--;
+	return new_block(f->statements);
 }
 
 Node *
@@ -64,6 +311,10 @@ parser_statement(Parser *p)
 		return parser_function_statement(p);
 	} else if (parser_accept(p, "return")) {
 		return parser_return_statement(p);
+	} else if (parser_accept(p, "spawn")) {
+		return parser_spawn_statement(p);
+	} else if (parser_accept(p, "join")) {
+		return parser_join_statement(p);
 	} else if (parser_accept(p, "id")) {
 		Node *node = NULL;
 		const char *id = parser_expect(p, "id");
@@ -75,7 +326,7 @@ parser_statement(Parser *p)
 		parser_expect(p, ";");
 		return node;
 	} else {
-		parser_expect(p, "var|print|if|while|fn|return");
+		parser_expect(p, "var|print|if|while|fn|return|spawn|join");
 		return NULL;
 	}
 }
@@ -97,7 +348,7 @@ parser_print(Parser *p)
 	parser_expect(p, "print");
 	Node *expression = parser_boolean_expression(p);
 	parser_expect(p, ";");
-	PrintStatement *ps = malloc(sizeof *ps);
+	PrintStatement *ps = STATS_ALLOC(STATS_AST, sizeof *ps);
 	ps->expression = expression;
 	return new_node(AST_PRINT_STATEMENT, ps);
 }
@@ -143,25 +394,148 @@ parser_continue_statement(Parser *p)
 Node *
 parser_function_statement(Parser *p)
 {
-	List *parameters = new_list();
-	parser_expect(p, "fn");
-	const char *name = parser_expect(p, "id");
-	parser_expect(p, "(");
-	if (parser_accept(p, "id")) {
-		list_append(parameters, parser_expect(p, "id"));
-		while (1) {
-			if (!parser_accept(p, ",")) {
-				break;
+	struct parser_frame f;
+	parser_function_header(p, &f);
+	Node *block = parser_block(p);
+	parser_expect(p, "}");
+	return new_function_statement(f.name, f.parameters, block, f.offset);
+}
+
+Node *
+parser_function_block(Parser *p, FunctionStatement *fs)
+{
+	if (fs->block == NULL) {
+		Token *token = p->token, *prev = p->prev;
+		long offset = ftell(p->lexer->in);
+		int depth = p->depth;
+		fseek(p->lexer->in, fs->body, SEEK_SET);
+		p->token = parser_lex(p->lexer);
+		p->depth = fs->depth;
+		fs->block = parser_block(p);
+		p->depth = depth;
+		if (parser_accept(p, "}") && p->token->offset != fs->end) {
+			lexer_error(p->lexer, p->token->offset, "body of '%s' ends before its closing '}'", fs->name);
+		}
+		parser_expect(p, "}");
+		fseek(p->lexer->in, offset, SEEK_SET);
+		p->token = token;
+		p->prev = prev;
+	}
+	return fs->block;
+}
+
+static void
+parser_uses(List *functions, List *calls, Node *node)
+{
+	ListNode *n;
+	if (node == NULL) {
+		return;
+	}
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			parser_uses(functions, calls, (Node *)n->value);
+		}
+		break;
+	case AST_ASSIGNMENT_STATEMENT:
+		parser_uses(functions, calls, ((AssignmentStatement *)node->value)->expression);
+		break;
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			parser_uses(functions, calls, (Node *)n->value);
+		}
+		break;
+	case AST_BOOLEAN_EXPRESSION:
+		parser_uses(functions, calls, ((BooleanExpression *)node->value)->left);
+		parser_uses(functions, calls, ((BooleanExpression *)node->value)->right);
+		break;
+	case AST_CALL_EXPRESSION:
+		list_append(calls, node->value);
+		for (n = ((CallExpression *)node->value)->arguments->head; n; n = n->next) {
+			parser_uses(functions, calls, (Node *)n->value);
+		}
+		break;
+	case AST_DECLARATION_STATEMENT:
+		parser_uses(functions, calls, ((DeclarationStatement *)node->value)->expression);
+		break;
+	case AST_FUNCTION_STATEMENT:
+		list_append(functions, node->value);
+		parser_uses(functions, calls, ((FunctionStatement *)node->value)->block);
+		break;
+	case AST_IF_STATEMENT:
+		parser_uses(functions, calls, ((IfStatement *)node->value)->booleanExpression);
+		parser_uses(functions, calls, ((IfStatement *)node->value)->block);
+		break;
+	case AST_INDEX_EXPRESSION:
+		parser_uses(functions, calls, ((IndexExpression *)node->value)->array);
+		parser_uses(functions, calls, ((IndexExpression *)node->value)->index);
+		break;
+	case AST_LOGICAL_NOT_EXPRESSION:
+		parser_uses(functions, calls, ((LogicalNotExpression *)node->value)->booleanExpression);
+		break;
+	case AST_LOGICAL_OPERAND:
+		parser_uses(functions, calls, ((LogicalOperand *)node->value)->left);
+		parser_uses(functions, calls, ((LogicalOperand *)node->value)->right);
+		break;
+	case AST_PRINT_STATEMENT:
+		parser_uses(functions, calls, ((PrintStatement *)node->value)->expression);
+		break;
+	case AST_RETURN_STATEMENT:
+		parser_uses(functions, calls, ((ReturnStatement *)node->value)->expression);
+		break;
+	case AST_SPAWN_STATEMENT:
+		parser_uses(functions, calls, ((SpawnStatement *)node->value)->callExpression);
+		break;
+	case AST_TERM:
+		parser_uses(functions, calls, ((Term *)node->value)->left);
+		parser_uses(functions, calls, ((Term *)node->value)->right);
+		break;
+	case AST_WHILE_STATEMENT:
+		parser_uses(functions, calls, ((WhileStatement *)node->value)->booleanExpression);
+		parser_uses(functions, calls, ((WhileStatement *)node->value)->block);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+parser_resolve_call(Parser *p, List *functions, List *calls, FunctionStatement *fs,
+    const CallExpression *ce)
+{
+	if (fs->block == NULL && !strcmp(fs->name, ce->name)) {
+		parser_uses(functions, calls, parser_function_block(p, fs));
+	}
+}
+
+/*
+ * Parses the body of every lazy function that a call in block can
+ * reach, directly or through other bodies, and leaves the rest unparsed.
+ * Calls are matched by name alone, as pure and types look them up, and
+ * each newly found call or function is matched against every one seen
+ * so far.
+ */
+void
+parser_resolve(Parser *p, Node *block)
+{
+	List *functions = new_list(), *calls = new_list();
+	ListNode *c = NULL, *f = NULL, *n;
+	parser_uses(functions, calls, block);
+	while (1) {
+		if (c != calls->tail) {
+			c = c ? c->next : calls->head;
+			for (n = functions->head; n; n = n->next) {
+				parser_resolve_call(p, functions, calls, (FunctionStatement *)n->value, c->value);
 			}
-			parser_expect(p, ",");
-			list_append(parameters, parser_expect(p, "id"));
+		} else if (f != functions->tail) {
+			f = f ? f->next : functions->head;
+			for (n = calls->head; n; n = n->next) {
+				parser_resolve_call(p, functions, calls, (FunctionStatement *)f->value, n->value);
+			}
+		} else {
+			break;
 		}
 	}
-	parser_expect(p, ")");
-	parser_expect(p, "{");
-	Node *block = parser_block(p);
-	parser_expect(p, "}");
-	return new_function_statement(name, parameters, block);
 }
 
 Node *
@@ -177,6 +551,24 @@ parser_return_statement(Parser *p)
 	return new_return_statement(be);
 }
 
+Node *
+parser_spawn_statement(Parser *p)
+{
+	parser_expect(p, "spawn");
+	const char *id = parser_expect(p, "id");
+	Node *ce = parser_call_expression(p, id);
+	parser_expect(p, ";");
+	return new_spawn_statement(ce);
+}
+
+Node *
+parser_join_statement(Parser *p)
+{
+	parser_expect(p, "join");
+	parser_expect(p, ";");
+	return new_join_statement();
+}
+
 Node *
 parser_assignment(Parser *p, const char *id)
 {
@@ -184,145 +576,333 @@ parser_assignment(Parser *p, const char *id)
 	return new_assignment_statement(id, parser_boolean_expression(p));
 }
 
-Node *
-parser_call_expression(Parser *p, const char *id)
+static int
+parser_precedence(Parser *p)
 {
-	List *arguments = new_list();
-	parser_expect(p, "(");
+	const char *s = p->token->symbol;
+	if (!strcmp(s, "or")) {
+		return PREC_OR;
+	} else if (!strcmp(s, "and")) {
+		return PREC_AND;
+	} else if (!strcmp(s, "==") || !strcmp(s, "!=") || !strcmp(s, ">=") ||
+	    !strcmp(s, ">") || !strcmp(s, "<") || !strcmp(s, "<=")) {
+		return PREC_CONDITION;
+	} else if (!strcmp(s, "+") || !strcmp(s, "-")) {
+		return PREC_OPERAND;
+	} else if (!strcmp(s, "*") || !strcmp(s, "/")) {
+		return PREC_TERM;
+	}
+	return 0;
+}
+
+static struct parser_operator *
+parser_push_operator(Parser *p, int base, int kind, int prec, const char *operator)
+{
+	parser_nesting(p, p->noperators - base + 1);
+	if (p->noperators == p->operatorscap) {
+		p->operatorscap = p->operatorscap ? p->operatorscap * 2 : 64;
+		p->operators = realloc(p->operators, p->operatorscap * sizeof *p->operators);
+	}
+	struct parser_operator *o = &p->operators[p->noperators++];
+	o->kind = kind;
+	o->prec = prec;
+	o->operator = operator;
+	o->arguments = NULL;
+	o->height = 0;
+	return o;
+}
+
+/* Sets the height of the top operand, which must not take the tree past maxdepth. */
+static void
+parser_height(Parser *p, int height)
+{
+	parser_nesting(p, p->depth + 2 * p->nframes + height);
+	p->heights[p->noperands - 1] = height;
+}
+
+static void
+parser_push_operand(Parser *p, Node *node)
+{
+	if (p->noperands == p->operandscap) {
+		p->operandscap = p->operandscap ? p->operandscap * 2 : 64;
+		p->operands = realloc(p->operands, p->operandscap * sizeof *p->operands);
+		p->heights = realloc(p->heights, p->operandscap * sizeof *p->heights);
+	}
+	p->operands[p->noperands++] = node;
+	parser_height(p, 1);
+}
+
+static void
+parser_reduce(Parser *p)
+{
+	struct parser_operator *o = &p->operators[--p->noperators];
+	if (o->kind == PARSER_NOT) {
+		p->operands[p->noperands - 1] = new_logical_not_expression(p->operands[p->noperands - 1]);
+		parser_height(p, p->heights[p->noperands - 1] + 1);
+		return;
+	}
+	Node *right = p->operands[--p->noperands];
+	Node *left = p->operands[p->noperands - 1];
+	int height = p->heights[p->noperands] > p->heights[p->noperands - 1] ?
+	    p->heights[p->noperands] : p->heights[p->noperands - 1];
+	if (o->prec == PREC_OPERAND) {
+		p->operands[p->noperands - 1] = new_logical_operand(left, o->operator, right);
+	} else if (o->prec == PREC_TERM) {
+		p->operands[p->noperands - 1] = new_term(left, o->operator, right);
+	} else {
+		p->operands[p->noperands - 1] = new_boolean_expression(left, o->operator, right);
+	}
+	parser_height(p, height + 1);
+}
+
+static struct parser_operator *
+parser_group(Parser *p, int base)
+{
+	int i;
+	for (i = p->noperators - 1; i >= base; i--) {
+		if (p->operators[i].kind != PARSER_BINARY && p->operators[i].kind != PARSER_NOT) {
+			return &p->operators[i];
+		}
+	}
+	return NULL;
+}
+
+static const char *
+parser_separator(struct parser_operator *group)
+{
+	switch (group->kind) {
+	case PARSER_PAREN:
+		return ")";
+	case PARSER_INDEX:
+		return "]";
+	default:
+		return ",";
+	}
+}
+
+static void
+parser_reduce_group(Parser *p, struct parser_operator *group)
+{
+	while (&p->operators[p->noperators - 1] != group) {
+		parser_reduce(p);
+	}
+}
+
+static void
+parser_finish_call(Parser *p)
+{
+	struct parser_operator *o = &p->operators[--p->noperators];
+	parser_push_operand(p, new_call_expression(o->operator, o->arguments, o->offset));
+	parser_height(p, o->height + 1);
+}
+
+static void
+parser_finish_array(Parser *p)
+{
+	struct parser_operator *o = &p->operators[--p->noperators];
+	parser_push_operand(p, new_array_literal(o->arguments));
+	parser_height(p, o->height + 1);
+}
+
+/* Moves the top operand into the argument or element list of group. */
+static void
+parser_argument(Parser *p, struct parser_operator *group)
+{
+	Node *node = p->operands[--p->noperands];
+	if (p->heights[p->noperands] > group->height) {
+		group->height = p->heights[p->noperands];
+	}
+	list_append(group->arguments, node);
+}
+
+static Node *
+parser_expression(Parser *p, int minprec, const char *call, uint32_t offset)
+{
+	int base = p->noperators;
+	int operand = 1;
+	if (call) {
+		struct parser_operator *o = parser_push_operator(p, base, PARSER_CALL, 0, call);
+		o->arguments = new_list();
+		o->offset = offset;
+	}
 	while (1) {
-		if (parser_accept(p, ")")) {
-			break;
+		int nested = p->noperators > base;
+		if (operand) {
+			if (parser_accept(p, "not") && (nested || minprec <= PREC_NOT)) {
+				parser_expect(p, "not");
+				parser_push_operator(p, base, PARSER_NOT, PREC_NOT, "not");
+			} else if (parser_accept(p, "(")) {
+				parser_expect(p, "(");
+				parser_push_operator(p, base, PARSER_PAREN, 0, "(");
+			} else if (parser_accept(p, "[")) {
+				parser_expect(p, "[");
+				struct parser_operator *o = parser_push_operator(p, base, PARSER_ARRAY, 0, "[");
+				o->arguments = new_list();
+			} else if (parser_accept(p, "]") && nested &&
+			    p->operators[p->noperators - 1].kind == PARSER_ARRAY) {
+				parser_expect(p, "]");
+				parser_finish_array(p);
+				operand = 0;
+			} else if (parser_accept(p, ")") && nested &&
+			    p->operators[p->noperators - 1].kind == PARSER_CALL) {
+				parser_expect(p, ")");
+				parser_finish_call(p);
+				operand = 0;
+				if (call && p->noperators == base) {
+					break;
+				}
+			} else if (parser_accept(p, "id")) {
+				const char *id = parser_expect(p, "id");
+				if (parser_accept(p, "(")) {
+					Token *name = p->prev;
+					parser_expect(p, "(");
+					struct parser_operator *o = parser_push_operator(p, base, PARSER_CALL, 0, id);
+					o->arguments = new_list();
+					o->offset = name->offset;
+				} else {
+					parser_push_operand(p, new_identifier(id));
+					operand = 0;
+				}
+			} else if (parser_accept(p, "number")) {
+				parser_push_operand(p, new_number_literal(parser_expect(p, "number")));
+				operand = 0;
+			} else if (parser_accept(p, "string")) {
+				parser_push_operand(p, new_string_literal(parser_expect(p, "string")));
+				operand = 0;
+			} else if (parser_accept(p, "true")) {
+				parser_expect(p, "true");
+				parser_push_operand(p, new_boolean_literal(1));
+				operand = 0;
+			} else if (parser_accept(p, "false")) {
+				parser_expect(p, "false");
+				parser_push_operand(p, new_boolean_literal(0));
+				operand = 0;
+			} else {
+				parser_expect(p, "id|number|string|true|false");
+			}
+			continue;
 		}
-		list_append(arguments, parser_boolean_expression(p));
-		if (!parser_accept(p, ")")) {
+		struct parser_operator *group = parser_group(p, base);
+		int prec = parser_precedence(p);
+		if (prec && (group || prec >= minprec)) {
+			while (p->noperators > base) {
+				int top = p->operators[p->noperators - 1].prec;
+				if (top < prec || (prec == PREC_CONDITION && top == PREC_CONDITION)) {
+					break;
+				}
+				parser_reduce(p);
+			}
+			if (prec == PREC_CONDITION && p->noperators > base &&
+			    p->operators[p->noperators - 1].prec == PREC_CONDITION) {
+				if (group == NULL) {
+					break;
+				}
+				parser_expect(p, parser_separator(group));
+			}
+			const char *operator = parser_expect(p, p->token->symbol);
+			if (prec == PREC_OR) {
+				operator = "or";
+			} else if (prec == PREC_AND) {
+				operator = "and";
+			}
+			parser_push_operator(p, base, PARSER_BINARY, prec, operator);
+			operand = 1;
+		} else if (parser_accept(p, "[")) {
+			parser_expect(p, "[");
+			parser_push_operator(p, base, PARSER_INDEX, 0, "[");
+			operand = 1;
+		} else if (group && (group->kind == PARSER_PAREN || group->kind == PARSER_CALL) &&
+		    parser_accept(p, ")")) {
+			parser_reduce_group(p, group);
+			parser_expect(p, ")");
+			if (group->kind == PARSER_PAREN) {
+				p->noperators--;
+			} else {
+				parser_argument(p, group);
+				parser_finish_call(p);
+				if (call && p->noperators == base) {
+					break;
+				}
+			}
+		} else if (group && (group->kind == PARSER_ARRAY || group->kind == PARSER_INDEX) &&
+		    parser_accept(p, "]")) {
+			parser_reduce_group(p, group);
+			parser_expect(p, "]");
+			if (group->kind == PARSER_ARRAY) {
+				parser_argument(p, group);
+				parser_finish_array(p);
+			} else {
+				Node *index = p->operands[--p->noperands];
+				int height = p->heights[p->noperands] > p->heights[p->noperands - 1] ?
+				    p->heights[p->noperands] : p->heights[p->noperands - 1];
+				p->noperators--;
+				p->operands[p->noperands - 1] = new_index_expression(p->operands[p->noperands - 1], index);
+				parser_height(p, height + 1);
+			}
+		} else if (group && (group->kind == PARSER_CALL || group->kind == PARSER_ARRAY) &&
+		    parser_accept(p, ",")) {
+			parser_reduce_group(p, group);
 			parser_expect(p, ",");
+			parser_argument(p, group);
+			operand = 1;
+		} else if (group) {
+			parser_expect(p, parser_separator(group));
+		} else {
+			break;
 		}
 	}
-	parser_expect(p, ")");
-	return new_call_expression(id, arguments);
+	while (p->noperators > base) {
+		parser_reduce(p);
+	}
+	return p->operands[--p->noperands];
+}
+
+Node *
+parser_call_expression(Parser *p, const char *id)
+{
+	Token *name = p->prev;
+	parser_expect(p, "(");
+	return parser_expression(p, PREC_OR, id, name->offset);
 }
 
 Node *
 parser_boolean_expression(Parser *p)
 {
-	Node *b = parser_and_expression(p);
-	while (1) {
-		if (parser_accept(p, "or")) {
-			parser_expect(p, "or");
-			b = new_boolean_expression(b, "or", parser_and_expression(p));
-		} else {
-			return b;
-		}
-	}
+	return parser_expression(p, PREC_OR, NULL, 0);
 }
 
 Node *
 parser_and_expression(Parser *p)
 {
-	Node *b = parser_condition(p);
-	while (1) {
-		if (parser_accept(p, "and")) {
-			parser_expect(p, "and");
-			b = new_boolean_expression(b, "and", parser_condition(p));
-		} else {
-			return b;
-		}
-	}
+	return parser_expression(p, PREC_AND, NULL, 0);
 }
 
 Node *
 parser_condition(Parser *p)
 {
-	const char *operator;
-	Node *left = parser_logical_operand(p);
-	if (parser_accept(p, "==")) {
-		operator = parser_expect(p, "==");
-	} else if (parser_accept(p, "!=")) {
-		operator = parser_expect(p, "!=");
-	} else if (parser_accept(p, ">=")) {
-		operator = parser_expect(p, ">=");
-	} else if (parser_accept(p, ">")) {
-		operator = parser_expect(p, ">");
-	} else if (parser_accept(p, "<")) {
-		operator = parser_expect(p, "<");
-	} else if (parser_accept(p, "<=")) {
-		operator = parser_expect(p, "<=");
-	} else {
-		return left;
-	}
-	return new_boolean_expression(left, operator, parser_logical_operand(p));
+	return parser_expression(p, PREC_CONDITION, NULL, 0);
 }
 
 Node *
 parser_logical_operand(Parser *p)
 {
-	Node *t = parser_term(p);
-	while (1) {
-		if (parser_accept(p, "+")) {
-			parser_expect(p, "+");
-			t = new_logical_operand(t, "+", parser_term(p));
-		} else if (parser_accept(p, "-")) {
-			parser_expect(p, "-");
-			t = new_logical_operand(t, "-", parser_term(p));
-		} else {
-			return t;
-		}
-	}
+	return parser_expression(p, PREC_OPERAND, NULL, 0);
 }
 
 Node *
 parser_term(Parser *p)
 {
-	Node *t = parser_logical_not_expression(p);
-	while (1) {
-		if (parser_accept(p, "*")) {
-			parser_expect(p, "*");
-			t = new_term(t, "*", parser_logical_not_expression(p));
-		} else if (parser_accept(p, "/")) {
-			parser_expect(p, "/");
-			t = new_term(t, "/", parser_logical_not_expression(p));
-		} else {
-			return t;
-		}
-	}
+	return parser_expression(p, PREC_TERM, NULL, 0);
 }
 
 Node *
 parser_logical_not_expression(Parser *p)
 {
-	if (parser_accept(p, "not")) {
-		parser_expect(p, "not");
-		return new_logical_not_expression(parser_logical_not_expression(p));
-	}
-	return parser_atom(p);
+	return parser_expression(p, PREC_NOT, NULL, 0);
 }
 
 Node *
 parser_atom(Parser *p)
 {
-	if (parser_accept(p, "id")) {
-		const char *id = parser_expect(p, "id");
-		if (parser_accept(p, "(")) {
-			return parser_call_expression(p, id);
-		}
-		return new_identifier(id);
-	} else if (parser_accept(p, "number")) {
-		return new_number_literal(parser_expect(p, "number"));
-	} else if (parser_accept(p, "string")) {
-		return new_string_literal(parser_expect(p, "string"));
-	} else if (parser_accept(p, "true")) {
-		parser_expect(p, "true");
-		return new_boolean_literal(1);
-	} else if (parser_accept(p, "false")) {
-		parser_expect(p, "false");
-		return new_boolean_literal(0);
-	} else if (parser_accept(p, "(")) {
-		parser_expect(p, "(");
-		Node *be = parser_boolean_expression(p);
-		parser_expect(p, ")");
-		return be;
-	} else {
-		parser_expect(p, "id|number|string|true|false");
-		return NULL;
-	}
+	return parser_expression(p, PREC_ATOM, NULL, 0);
 }
@@ -2,11 +2,26 @@
 #define PARSE_H 1
 #include "ast.h"
 #include "lex.h"
+#ifndef PARSER_MAX_DEPTH
+#define PARSER_MAX_DEPTH 2000
+#endif
 typedef struct {
 	Lexer *lexer;
 	Token *token;
+	Token *prev;
+	int maxdepth;
+	int depth;
+	int lazy;
+	struct parser_frame *frames;
+	int nframes, framescap;
+	struct parser_operator *operators;
+	int noperators, operatorscap;
+	Node **operands;
+	int *heights;
+	int noperands, operandscap;
 } Parser;
 Parser *new_parser(Lexer *lexer);
+void parser_close(Parser *p);
 int parser_accept(Parser *p, const char *expected);
 Node *parser_and_expression(Parser *p);
 Node *parser_assignment(Parser *p, const char *id);
@@ -19,12 +34,16 @@ Node *parser_condition(Parser *p);
 Node *parser_continue_statement(Parser *p);
 Node *parser_declaration(Parser *p);
 const char *parser_expect(Parser *p, const char *expected);
+Node *parser_function_block(Parser *p, FunctionStatement *fs);
 Node *parser_function_statement(Parser *p);
 Node *parser_if_statement(Parser *p);
+Node *parser_join_statement(Parser *p);
 Node *parser_logical_not_expression(Parser *p);
 Node *parser_logical_operand(Parser *p);
 Node *parser_print(Parser *p);
+void parser_resolve(Parser *p, Node *block);
 Node *parser_return_statement(Parser *p);
+Node *parser_spawn_statement(Parser *p);
 Node *parser_statement(Parser *p);
 Node *parser_term(Parser *p);
 Node *parser_while_statement(Parser *p);
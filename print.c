@@ -1,81 +1,181 @@
 #include "ast.h"
-#include "string.h"
+#include "str.h"
 #include <stdlib.h>
 
-const char *
-str_list_str(List *list)
+static void node_build(String *out, Node *node);
+
+static void
+str_list_build(String *out, List *list)
 {
-	const char *s = NULL;
-	int len;
 	ListNode *n;
-	for (n = list->head, len = 0; n; n = n->next, len++) {
-		if (len != 0) {
-			s = sprintf_alloc("%s%s", s, " ");
+	if (list->head == NULL) {
+		string_append(out, "nil");
+	}
+	for (n = list->head; n; n = n->next) {
+		if (n != list->head) {
+			string_append(out, " ");
 		}
-		s = sprintf_alloc("%s%s", s, node_str(n->value));
+		node_build(out, (Node *)n->value);
 	}
-	return len != 0 ? s : sprintf_alloc("%s", "nil");
 }
 
-const char *
-node_str(Node *node)
+static void
+id_list_build(String *out, List *list)
+{
+	ListNode *n;
+	if (list->head == NULL) {
+		string_append(out, "nil");
+	}
+	for (n = list->head; n; n = n->next) {
+		if (n != list->head) {
+			string_append(out, " ");
+		}
+		string_append(out, (const char *)n->value);
+	}
+}
+
+static void
+node_build(String *out, Node *node)
 {
+	if (node == NULL) {
+		string_append(out, "nil");
+		return;
+	}
 	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		ArrayLiteral *al = (ArrayLiteral *)node->value;
+		string_append(out, "(array ");
+		str_list_build(out, al->elements);
+		break;
 	case AST_ASSIGNMENT_STATEMENT:
 		AssignmentStatement *as = (AssignmentStatement *)node->value;
-		sprintf_alloc("(assignment %s %s)", as->id, node_str(as->expression));
+		string_appendf(out, "(assignment %s ", as->id);
+		node_build(out, as->expression);
+		break;
 	case AST_BLOCK:
 		Block *b = (Block *)node->value;
-		return sprintf_alloc("(block %s)", str_list_str(b->statements));
+		string_append(out, "(block ");
+		str_list_build(out, b->statements);
+		break;
 	case AST_BOOLEAN_EXPRESSION:
 		BooleanExpression *be = (BooleanExpression *)node->value;
-		return sprintf_alloc("(bool %s %s %s)", node_str(be->left), be->operator, node_str(be->right));
+		string_append(out, "(bool ");
+		node_build(out, be->left);
+		string_appendf(out, " %s ", be->operator);
+		node_build(out, be->right);
+		break;
 	case AST_BOOLEAN_LITERAL:
 		BooleanLiteral *bl = (BooleanLiteral *)node->value;
-		return sprintf_alloc("(%s)", bl->value);
+		string_append(out, bl->value ? "(true" : "(false");
+		break;
 	case AST_BREAK_STATEMENT:
-		return sprintf_alloc("(break)");
+		string_append(out, "(break");
+		break;
 	case AST_CALL_EXPRESSION:
 		CallExpression *ce = (CallExpression *)node->value;
-		return sprintf_alloc("(call %s %s)", ce->name, node_str(ce->arguments));
+		string_appendf(out, "(call %s ", ce->name);
+		str_list_build(out, ce->arguments);
+		break;
 	case AST_CONTINUE_STATEMENT:
-		return sprintf_alloc("(continue)");
+		string_append(out, "(continue");
+		break;
 	case AST_DECLARATION_STATEMENT:
 		DeclarationStatement *ds = (DeclarationStatement *)node->value;
-		return sprintf_alloc("(decl %s %s)", ds->id, node_str(ds->expression));
+		string_appendf(out, "(decl %s ", ds->id);
+		node_build(out, ds->expression);
+		break;
 	case AST_FUNCTION_STATEMENT:
 		FunctionStatement *fs = (FunctionStatement *)node->value;
-		return sprintf_alloc("(func %s %s %s)", fs->name, str_list_str(fs->parameters), node_str(fs->block));
+		string_appendf(out, "(func %s ", fs->name);
+		id_list_build(out, fs->parameters);
+		string_append(out, " ");
+		node_build(out, fs->block);
+		break;
 	case AST_IDENTIFIER:
 		Identifier *i = (Identifier *)node->value;
-		return sprintf_alloc("(id %s)", i->value);
+		string_appendf(out, "(id %s", i->value);
+		break;
 	case AST_IF_STATEMENT:
 		IfStatement *is = (IfStatement *)node->value;
-		return sprintf_alloc("(if %s %s)", node_str(is->booleanExpression), node_str(is->block));
+		string_append(out, "(if ");
+		node_build(out, is->booleanExpression);
+		string_append(out, " ");
+		node_build(out, is->block);
+		break;
+	case AST_INDEX_EXPRESSION:
+		IndexExpression *ie = (IndexExpression *)node->value;
+		string_append(out, "(index ");
+		node_build(out, ie->array);
+		string_append(out, " ");
+		node_build(out, ie->index);
+		break;
+	case AST_JOIN_STATEMENT:
+		string_append(out, "(join");
+		break;
 	case AST_LOGICAL_NOT_EXPRESSION:
 		LogicalNotExpression *lne = (LogicalNotExpression *)node->value;
-		return sprintf_alloc("(not %s)", node_str(lne->booleanExpression));
+		string_append(out, "(not ");
+		node_build(out, lne->booleanExpression);
+		break;
 	case AST_LOGICAL_OPERAND:
 		LogicalOperand *lo = (LogicalOperand *)node->value;
-		return sprintf_alloc("(logOp %s %s %s)", node_str(lo->left), lo->operator, node_str(lo->right));
+		string_append(out, "(logOp ");
+		node_build(out, lo->left);
+		string_appendf(out, " %s ", lo->operator);
+		node_build(out, lo->right);
+		break;
 	case AST_NUMBER_LITERAL:
 		NumberLiteral *nl = (NumberLiteral *)node->value;
-		return sprintf_alloc("(num %s)", nl->value);
+		string_appendf(out, "(num %s", nl->value);
+		break;
 	case AST_PRINT_STATEMENT:
 		PrintStatement *ps = (PrintStatement *)node->value;
-		return sprintf_alloc("(print %s)", node_str(ps->expression));
+		string_append(out, "(print ");
+		node_build(out, ps->expression);
+		break;
 	case AST_RETURN_STATEMENT:
 		ReturnStatement *rs = (ReturnStatement *)node->value;
-		return sprintf_alloc("(return %s)", node_str(rs->expression));
+		string_append(out, "(return ");
+		node_build(out, rs->expression);
+		break;
+	case AST_SPAWN_STATEMENT:
+		SpawnStatement *ss = (SpawnStatement *)node->value;
+		string_append(out, "(spawn ");
+		node_build(out, ss->callExpression);
+		break;
 	case AST_STRING_LITERAL:
 		StringLiteral *sl = (StringLiteral *)node->value;
-		return sprintf_alloc("(str %s)", sl->value);
+		string_appendf(out, "(str %s", sl->value);
+		break;
 	case AST_TERM:
 		Term *t = (Term *)node->value;
-		return sprintf_alloc("(term %s %s %s)", node_str(t->left), t->operator, node_str(t->right));
+		string_append(out, "(term ");
+		node_build(out, t->left);
+		string_appendf(out, " %s ", t->operator);
+		node_build(out, t->right);
+		break;
 	case AST_WHILE_STATEMENT:
 		WhileStatement *ws = (WhileStatement *)node->value;
-		return sprintf_alloc("(while %s %s)", node_str(is->booleanExpression), node_str(is->block));
+		string_append(out, "(while ");
+		node_build(out, ws->booleanExpression);
+		string_append(out, " ");
+		node_build(out, ws->block);
+		break;
+	default:
+		string_append(out, "(unrecognized");
+		break;
 	}
-	return sprintf_alloc("(unrecognized)");
+	string_append(out, ")");
+}
+
+/*
+ * Every node appends to one String, so printing a tree is linear in the
+ * size of the output rather than copying each subtree once per level.
+ */
+const char *
+node_str(Node *node)
+{
+	String out = {0, 0, NULL};
+	node_build(&out, node);
+	return out.s;
 }
@@ -0,0 +1,251 @@
+#include "ast.h"
+#include "builtin.h"
+#include "list.h"
+#include "pure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A function is pure when its body only reads its parameters and locals,
+ * calls other pure functions or pure builtins and never prints. Every
+ * function starts out pure and is demoted until nothing changes, so
+ * (mutually) recursive functions stay pure unless something in the
+ * cycle is not.
+ */
+
+typedef struct {
+	const char **names;
+	int len, cap;
+} Scope;
+
+static int pure_block(List *functions, Scope *scope, Node *node);
+static int pure_expression(List *functions, Scope *scope, Node *node);
+static int pure_statement(List *functions, Scope *scope, Node *node);
+
+static void
+scope_push(Scope *scope, const char *name)
+{
+	if (scope->len == scope->cap) {
+		scope->cap = scope->cap ? scope->cap * 2 : 16;
+		scope->names = realloc(scope->names, scope->cap * sizeof *scope->names);
+	}
+	scope->names[scope->len++] = name;
+}
+
+static int
+scope_has(Scope *scope, const char *name)
+{
+	int i;
+	for (i = scope->len - 1; i >= 0; i--) {
+		if (!strcmp(scope->names[i], name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static FunctionStatement *
+pure_lookup(List *functions, const char *name)
+{
+	ListNode *n;
+	for (n = functions->head; n; n = n->next) {
+		FunctionStatement *fs = (FunctionStatement *)((Node *)n->value)->value;
+		if (!strcmp(fs->name, name)) {
+			return fs;
+		}
+	}
+	return NULL;
+}
+
+static void
+pure_collect(List *functions, Node *node)
+{
+	ListNode *n;
+	if (node == NULL) {
+		return;
+	}
+	switch (node->type) {
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			if (n->value) {
+				pure_collect(functions, (Node *)n->value);
+			}
+		}
+		break;
+	case AST_FUNCTION_STATEMENT:
+		list_append(functions, node);
+		pure_collect(functions, ((FunctionStatement *)node->value)->block);
+		break;
+	case AST_IF_STATEMENT:
+		pure_collect(functions, ((IfStatement *)node->value)->block);
+		break;
+	case AST_WHILE_STATEMENT:
+		pure_collect(functions, ((WhileStatement *)node->value)->block);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+pure_expression(List *functions, Scope *scope, Node *node)
+{
+	ListNode *n;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			if (!pure_expression(functions, scope, (Node *)n->value)) {
+				return 0;
+			}
+		}
+		return 1;
+	case AST_BOOLEAN_EXPRESSION: {
+		BooleanExpression *be = (BooleanExpression *)node->value;
+		return pure_expression(functions, scope, be->left) &&
+		    pure_expression(functions, scope, be->right);
+	}
+	case AST_LOGICAL_OPERAND: {
+		LogicalOperand *lo = (LogicalOperand *)node->value;
+		return pure_expression(functions, scope, lo->left) &&
+		    pure_expression(functions, scope, lo->right);
+	}
+	case AST_TERM: {
+		Term *t = (Term *)node->value;
+		return pure_expression(functions, scope, t->left) &&
+		    pure_expression(functions, scope, t->right);
+	}
+	case AST_INDEX_EXPRESSION: {
+		IndexExpression *ie = (IndexExpression *)node->value;
+		return pure_expression(functions, scope, ie->array) &&
+		    pure_expression(functions, scope, ie->index);
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		return pure_expression(functions, scope, ((LogicalNotExpression *)node->value)->booleanExpression);
+	case AST_CALL_EXPRESSION: {
+		CallExpression *ce = (CallExpression *)node->value;
+		FunctionStatement *fs = pure_lookup(functions, ce->name);
+		const Builtin *builtin = fs ? NULL : builtin_lookup(ce->name);
+		if (fs ? !fs->pure : builtin == NULL || !builtin->pure) {
+			return 0;
+		}
+		for (n = ce->arguments->head; n; n = n->next) {
+			if (!pure_expression(functions, scope, (Node *)n->value)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+	case AST_IDENTIFIER:
+		return scope_has(scope, ((Identifier *)node->value)->value);
+	case AST_BOOLEAN_LITERAL:
+	case AST_NUMBER_LITERAL:
+	case AST_STRING_LITERAL:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+pure_statement(List *functions, Scope *scope, Node *node)
+{
+	if (node == NULL) {
+		return 1;
+	}
+	switch (node->type) {
+	case AST_ASSIGNMENT_STATEMENT: {
+		AssignmentStatement *as = (AssignmentStatement *)node->value;
+		return scope_has(scope, as->id) &&
+		    pure_expression(functions, scope, as->expression);
+	}
+	case AST_DECLARATION_STATEMENT: {
+		DeclarationStatement *ds = (DeclarationStatement *)node->value;
+		if (!pure_expression(functions, scope, ds->expression)) {
+			return 0;
+		}
+		scope_push(scope, ds->id);
+		return 1;
+	}
+	case AST_IF_STATEMENT: {
+		IfStatement *is = (IfStatement *)node->value;
+		return pure_expression(functions, scope, is->booleanExpression) &&
+		    pure_block(functions, scope, is->block);
+	}
+	case AST_WHILE_STATEMENT: {
+		WhileStatement *ws = (WhileStatement *)node->value;
+		return pure_expression(functions, scope, ws->booleanExpression) &&
+		    pure_block(functions, scope, ws->block);
+	}
+	case AST_RETURN_STATEMENT: {
+		ReturnStatement *rs = (ReturnStatement *)node->value;
+		return rs->expression == NULL ||
+		    pure_expression(functions, scope, rs->expression);
+	}
+	case AST_CALL_EXPRESSION:
+		return pure_expression(functions, scope, node);
+	case AST_BREAK_STATEMENT:
+	case AST_CONTINUE_STATEMENT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+pure_block(List *functions, Scope *scope, Node *node)
+{
+	ListNode *n;
+	int len = scope->len;
+	int pure = 1;
+	for (n = ((Block *)node->value)->statements->head; n && pure; n = n->next) {
+		pure = pure_statement(functions, scope, (Node *)n->value);
+	}
+	scope->len = len;
+	return pure;
+}
+
+static int
+pure_function(List *functions, FunctionStatement *fs)
+{
+	Scope scope = {NULL, 0, 0};
+	ListNode *n;
+	if (fs->block == NULL) {
+		return 0;
+	}
+	for (n = fs->parameters->head; n; n = n->next) {
+		scope_push(&scope, n->value);
+	}
+	int pure = pure_block(functions, &scope, fs->block);
+	free(scope.names);
+	return pure;
+}
+
+void
+pure_analyze(Node *block)
+{
+	List *functions = new_list();
+	ListNode *n;
+	int changed;
+	pure_collect(functions, block);
+	for (n = functions->head; n; n = n->next) {
+		((FunctionStatement *)((Node *)n->value)->value)->pure = 1;
+	}
+	do {
+		changed = 0;
+		for (n = functions->head; n; n = n->next) {
+			FunctionStatement *fs = (FunctionStatement *)((Node *)n->value)->value;
+			if (fs->pure && !pure_function(functions, fs)) {
+				fs->pure = 0;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	const char *puredebug = getenv("PUREDEBUG");
+	if (puredebug && strcmp(puredebug, "")) {
+		for (n = functions->head; n; n = n->next) {
+			FunctionStatement *fs = (FunctionStatement *)((Node *)n->value)->value;
+			fprintf(stderr, "%s %s\n", fs->pure ? "pure" : "impure", fs->name);
+		}
+	}
+}
@@ -0,0 +1,5 @@
+#ifndef PURE_H
+#define PURE_H 1
+#include "ast.h"
+void pure_analyze(Node *block);
+#endif
@@ -0,0 +1,500 @@
+#include "ast.h"
+#include "lang.h"
+#include "list.h"
+#include "snap.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Program snapshots. The tree and its line table are copied into one
+ * contiguous image in which every pointer is stored as an offset from the
+ * start of the image, and the position of each such pointer is recorded
+ * in a relocation table. Loading maps the file privately and adds the
+ * mapping address to every relocated field, so no lexing, parsing or
+ * analysis is repeated.
+ * Objects reachable twice, and strings with the same contents, are
+ * written once.
+ */
+
+#define SNAP_MAGIC "langsnap"
+#define SNAP_VERSION 6
+#define SNAP_ALIGN 8
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t pointersize;
+	uint64_t size;
+	uint64_t root;
+	uint64_t lines;
+	uint64_t relocs;
+	uint64_t nrelocs;
+	uint64_t checksum;
+} SnapHeader;
+
+typedef struct {
+	const void *key;
+	uint64_t offset;
+} SnapEntry;
+
+typedef struct {
+	SnapEntry *entries;
+	size_t len, cap;
+	int strings;
+} SnapTable;
+
+typedef struct {
+	char *buf;
+	size_t len, cap;
+	uint64_t *relocs;
+	size_t nrelocs, relocscap;
+	SnapTable objects, strings;
+} Snap;
+
+static uint64_t snap_node(Snap *s, const Node *node);
+
+static size_t
+snap_hash(SnapTable *t, const void *key)
+{
+	size_t h = 14695981039346656037UL;
+	const unsigned char *p;
+	if (!t->strings) {
+		return ((uintptr_t)key >> 3) * 11400714819323198485UL;
+	}
+	for (p = key; *p; p++) {
+		h = (h ^ *p) * 1099511628211UL;
+	}
+	return h;
+}
+
+static SnapEntry *
+snap_lookup(SnapTable *t, const void *key)
+{
+	size_t mask = t->cap - 1;
+	size_t i = snap_hash(t, key) & mask;
+	while (t->entries[i].key) {
+		if (t->strings ? !strcmp(t->entries[i].key, key) : t->entries[i].key == key) {
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return &t->entries[i];
+}
+
+static SnapEntry *
+snap_insert(SnapTable *t, const void *key)
+{
+	if (t->len * 2 >= t->cap) {
+		SnapEntry *old = t->entries;
+		size_t oldcap = t->cap, i;
+		t->cap = oldcap ? oldcap * 2 : 1024;
+		t->entries = calloc(t->cap, sizeof *t->entries);
+		for (i = 0; i < oldcap; i++) {
+			if (old[i].key) {
+				*snap_lookup(t, old[i].key) = old[i];
+			}
+		}
+		free(old);
+	}
+	return snap_lookup(t, key);
+}
+
+static uint64_t
+snap_write(Snap *s, const void *p, size_t size)
+{
+	size_t offset = (s->len + SNAP_ALIGN - 1) & ~(size_t)(SNAP_ALIGN - 1);
+	while (offset + size > s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 65536;
+		s->buf = realloc(s->buf, s->cap);
+	}
+	memset(s->buf + s->len, 0, offset - s->len);
+	memcpy(s->buf + offset, p, size);
+	s->len = offset + size;
+	return offset;
+}
+
+static void
+snap_pointer(Snap *s, uint64_t field, uint64_t target)
+{
+	if (s->nrelocs == s->relocscap) {
+		s->relocscap = s->relocscap ? s->relocscap * 2 : 1024;
+		s->relocs = realloc(s->relocs, s->relocscap * sizeof *s->relocs);
+	}
+	s->relocs[s->nrelocs++] = field;
+	memcpy(s->buf + field, &target, sizeof(void *));
+}
+
+static uint64_t
+snap_string(Snap *s, const char *str)
+{
+	if (str == NULL) {
+		return 0;
+	}
+	SnapEntry *e = snap_insert(&s->strings, str);
+	if (e->key == NULL) {
+		e->key = str;
+		e->offset = snap_write(s, str, strlen(str) + 1);
+		s->strings.len++;
+	}
+	return e->offset;
+}
+
+static void
+snap_field(Snap *s, uint64_t field, uint64_t target)
+{
+	if (target) {
+		snap_pointer(s, field, target);
+	} else {
+		memset(s->buf + field, 0, sizeof(void *));
+	}
+}
+
+static uint64_t
+snap_list(Snap *s, const List *list, int strings)
+{
+	uint64_t offset = snap_write(s, list, sizeof *list);
+	uint64_t prev = offset + offsetof(List, head);
+	uint64_t ln = 0;
+	ListNode *n;
+	for (n = list->head; n; n = n->next) {
+		ln = snap_write(s, n, sizeof *n);
+		snap_field(s, prev, ln);
+		snap_field(s, ln + offsetof(ListNode, value),
+		    strings ? snap_string(s, n->value) : snap_node(s, n->value));
+		prev = ln + offsetof(ListNode, next);
+	}
+	snap_field(s, prev, 0);
+	snap_field(s, offset + offsetof(List, tail), ln);
+	return offset;
+}
+
+#define SNAP_FIELD(type, field, target) \
+	snap_field(s, value + offsetof(type, field), (target))
+
+static uint64_t
+snap_value(Snap *s, const Node *node)
+{
+	uint64_t value;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL: {
+		const ArrayLiteral *al = node->value;
+		value = snap_write(s, al, sizeof *al);
+		SNAP_FIELD(ArrayLiteral, elements, snap_list(s, al->elements, 0));
+		return value;
+	}
+	case AST_ASSIGNMENT_STATEMENT: {
+		const AssignmentStatement *as = node->value;
+		value = snap_write(s, as, sizeof *as);
+		SNAP_FIELD(AssignmentStatement, id, snap_string(s, as->id));
+		SNAP_FIELD(AssignmentStatement, expression, snap_node(s, as->expression));
+		return value;
+	}
+	case AST_BLOCK: {
+		const Block *b = node->value;
+		value = snap_write(s, b, sizeof *b);
+		SNAP_FIELD(Block, statements, snap_list(s, b->statements, 0));
+		return value;
+	}
+	case AST_BOOLEAN_EXPRESSION: {
+		const BooleanExpression *be = node->value;
+		value = snap_write(s, be, sizeof *be);
+		SNAP_FIELD(BooleanExpression, left, snap_node(s, be->left));
+		SNAP_FIELD(BooleanExpression, operator, snap_string(s, be->operator));
+		SNAP_FIELD(BooleanExpression, right, snap_node(s, be->right));
+		return value;
+	}
+	case AST_BOOLEAN_LITERAL:
+		return snap_write(s, node->value, sizeof(BooleanLiteral));
+	case AST_CALL_EXPRESSION: {
+		const CallExpression *ce = node->value;
+		value = snap_write(s, ce, sizeof *ce);
+		SNAP_FIELD(CallExpression, name, snap_string(s, ce->name));
+		SNAP_FIELD(CallExpression, arguments, snap_list(s, ce->arguments, 0));
+		return value;
+	}
+	case AST_DECLARATION_STATEMENT: {
+		const DeclarationStatement *ds = node->value;
+		value = snap_write(s, ds, sizeof *ds);
+		SNAP_FIELD(DeclarationStatement, id, snap_string(s, ds->id));
+		SNAP_FIELD(DeclarationStatement, expression, snap_node(s, ds->expression));
+		return value;
+	}
+	case AST_FUNCTION_STATEMENT: {
+		const FunctionStatement *fs = node->value;
+		value = snap_write(s, fs, sizeof *fs);
+		SNAP_FIELD(FunctionStatement, name, snap_string(s, fs->name));
+		SNAP_FIELD(FunctionStatement, parameters, snap_list(s, fs->parameters, 1));
+		SNAP_FIELD(FunctionStatement, block, snap_node(s, fs->block));
+		return value;
+	}
+	case AST_IDENTIFIER: {
+		const Identifier *i = node->value;
+		value = snap_write(s, i, sizeof *i);
+		SNAP_FIELD(Identifier, value, snap_string(s, i->value));
+		return value;
+	}
+	case AST_IF_STATEMENT: {
+		const IfStatement *is = node->value;
+		value = snap_write(s, is, sizeof *is);
+		SNAP_FIELD(IfStatement, booleanExpression, snap_node(s, is->booleanExpression));
+		SNAP_FIELD(IfStatement, block, snap_node(s, is->block));
+		return value;
+	}
+	case AST_INDEX_EXPRESSION: {
+		const IndexExpression *ie = node->value;
+		value = snap_write(s, ie, sizeof *ie);
+		SNAP_FIELD(IndexExpression, array, snap_node(s, ie->array));
+		SNAP_FIELD(IndexExpression, index, snap_node(s, ie->index));
+		return value;
+	}
+	case AST_LOGICAL_NOT_EXPRESSION: {
+		const LogicalNotExpression *lne = node->value;
+		value = snap_write(s, lne, sizeof *lne);
+		SNAP_FIELD(LogicalNotExpression, booleanExpression, snap_node(s, lne->booleanExpression));
+		return value;
+	}
+	case AST_LOGICAL_OPERAND: {
+		const LogicalOperand *lo = node->value;
+		value = snap_write(s, lo, sizeof *lo);
+		SNAP_FIELD(LogicalOperand, left, snap_node(s, lo->left));
+		SNAP_FIELD(LogicalOperand, operator, snap_string(s, lo->operator));
+		SNAP_FIELD(LogicalOperand, right, snap_node(s, lo->right));
+		return value;
+	}
+	case AST_NUMBER_LITERAL: {
+		const NumberLiteral *nl = node->value;
+		value = snap_write(s, nl, sizeof *nl);
+		SNAP_FIELD(NumberLiteral, value, snap_string(s, nl->value));
+		return value;
+	}
+	case AST_PRINT_STATEMENT:
+	case AST_RETURN_STATEMENT: {
+		const PrintStatement *ps = node->value;
+		value = snap_write(s, ps, sizeof *ps);
+		SNAP_FIELD(PrintStatement, expression, snap_node(s, ps->expression));
+		return value;
+	}
+	case AST_SPAWN_STATEMENT: {
+		const SpawnStatement *ss = node->value;
+		value = snap_write(s, ss, sizeof *ss);
+		SNAP_FIELD(SpawnStatement, callExpression, snap_node(s, ss->callExpression));
+		return value;
+	}
+	case AST_STRING_LITERAL: {
+		const StringLiteral *sl = node->value;
+		value = snap_write(s, sl, sizeof *sl);
+		SNAP_FIELD(StringLiteral, value, snap_string(s, sl->value));
+		return value;
+	}
+	case AST_TERM: {
+		const Term *t = node->value;
+		value = snap_write(s, t, sizeof *t);
+		SNAP_FIELD(Term, left, snap_node(s, t->left));
+		SNAP_FIELD(Term, operator, snap_string(s, t->operator));
+		SNAP_FIELD(Term, right, snap_node(s, t->right));
+		return value;
+	}
+	case AST_WHILE_STATEMENT: {
+		const WhileStatement *ws = node->value;
+		value = snap_write(s, ws, sizeof *ws);
+		SNAP_FIELD(WhileStatement, booleanExpression, snap_node(s, ws->booleanExpression));
+		SNAP_FIELD(WhileStatement, block, snap_node(s, ws->block));
+		return value;
+	}
+	default:
+		return 0;
+	}
+}
+
+static uint64_t
+snap_node(Snap *s, const Node *node)
+{
+	if (node == NULL) {
+		return 0;
+	}
+	SnapEntry *e = snap_insert(&s->objects, node);
+	if (e->key) {
+		return e->offset;
+	}
+	uint64_t offset = snap_write(s, node, sizeof *node);
+	e->key = node;
+	e->offset = offset;
+	s->objects.len++;
+	snap_field(s, offset + offsetof(Node, value), snap_value(s, node));
+	return offset;
+}
+
+static uint64_t
+snap_lines(Snap *s, const LineTable *lines)
+{
+	if (lines == NULL) {
+		return 0;
+	}
+	uint64_t offset = snap_write(s, lines, sizeof *lines);
+	snap_field(s, offset + offsetof(LineTable, checkpoints), snap_write(s, lines->checkpoints,
+	    ((lines->nlines - 1) / LINES_STRIDE + 1) * sizeof *lines->checkpoints));
+	snap_field(s, offset + offsetof(LineTable, deltas), snap_write(s, lines->deltas, lines->ndeltas));
+	return offset;
+}
+
+static uint64_t
+snap_fnv(uint64_t hash, const void *p, size_t len)
+{
+	const unsigned char *c = p;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ c[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ * FNV-1a over the whole image, with the header's checksum field taken
+ * as zero. The range checks in lang_program_load cannot tell a root,
+ * line table or relocation that was moved to another valid place, so a
+ * damaged image is caught here instead.
+ */
+static uint64_t
+snap_checksum(const char *base, size_t size)
+{
+	SnapHeader header;
+	memcpy(&header, base, sizeof header);
+	header.checksum = 0;
+	uint64_t hash = snap_fnv(14695981039346656037ULL, &header, sizeof header);
+	return snap_fnv(hash, base + sizeof header, size - sizeof header);
+}
+
+int
+lang_program_save(const LangProgram *program, const char *path, LangError *error)
+{
+	Snap s = {0};
+	s.strings.strings = 1;
+	SnapHeader header = {
+		.magic = SNAP_MAGIC,
+		.version = SNAP_VERSION,
+		.pointersize = sizeof(void *),
+	};
+	snap_write(&s, &header, sizeof header);
+	header.root = snap_node(&s, program->block);
+	header.lines = snap_lines(&s, program->lines);
+	header.relocs = snap_write(&s, s.relocs, s.nrelocs * sizeof *s.relocs);
+	header.nrelocs = s.nrelocs;
+	header.size = s.len;
+	memcpy(s.buf, &header, sizeof header);
+	header.checksum = snap_checksum(s.buf, s.len);
+	memcpy(s.buf, &header, sizeof header);
+	FILE *f = fopen(path, "wb");
+	int ok = f && fwrite(s.buf, 1, s.len, f) == s.len;
+	if (f && fclose(f)) {
+		ok = 0;
+	}
+	if (!ok) {
+		snprintf(error->message, sizeof error->message, "cannot write snapshot %s", path);
+		error->line = 0;
+		error->column = 0;
+	}
+	free(s.buf);
+	free(s.relocs);
+	free(s.objects.entries);
+	free(s.strings.entries);
+	return ok;
+}
+
+/*
+ * Checks every relocation against the image before adding the base to
+ * it: the field must lie inside the image and hold an offset that does
+ * too. A field listed twice already holds an address the second time
+ * and fails the check, so a corrupt table cannot make a wild pointer.
+ * The root's value field must be among them.
+ */
+static int
+snap_relocate(char *base, const SnapHeader *header)
+{
+	const uint64_t *relocs = (const uint64_t *)(base + header->relocs);
+	uint64_t i;
+	int root = 0;
+	for (i = 0; i < header->nrelocs; i++) {
+		if (relocs[i] % sizeof(void *) || relocs[i] + sizeof(void *) > header->size) {
+			return 0;
+		}
+		char **field = (char **)(base + relocs[i]);
+		if ((uintptr_t)*field >= header->size) {
+			return 0;
+		}
+		*field = base + (uintptr_t)*field;
+		root |= relocs[i] == header->root + offsetof(Node, value);
+	}
+	return root;
+}
+
+/* Whether the relocated pointer p has len bytes of the image behind it. */
+static int
+snap_inside(const char *base, const SnapHeader *header, const void *p, uint64_t len)
+{
+	uint64_t offset = (uintptr_t)p - (uintptr_t)base;
+	return offset <= header->size && len <= header->size - offset;
+}
+
+/* Whether the line table's arrays, as long as its counts say, lie inside the image. */
+static int
+snap_lines_valid(const char *base, const SnapHeader *header)
+{
+	const LineTable *lines = (const LineTable *)(base + header->lines);
+	if (header->lines == 0) {
+		return 1;
+	}
+	return lines->nlines > 0 && lines->nlines <= header->size &&
+	    snap_inside(base, header, lines->checkpoints,
+	    ((lines->nlines - 1) / LINES_STRIDE + 1) * sizeof *lines->checkpoints) &&
+	    snap_inside(base, header, lines->deltas, lines->ndeltas);
+}
+
+LangProgram *
+lang_program_load(const char *path, LangError *error)
+{
+	struct stat st;
+	SnapHeader *header;
+	char *base = MAP_FAILED;
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof *header) {
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	header = (SnapHeader *)base;
+	if (base == MAP_FAILED || memcmp(header->magic, SNAP_MAGIC, sizeof header->magic) ||
+	    header->version != SNAP_VERSION || header->pointersize != sizeof(void *) ||
+	    header->size != (uint64_t)st.st_size ||
+	    header->checksum != snap_checksum(base, header->size) ||
+	    header->relocs % SNAP_ALIGN || header->relocs > header->size ||
+	    header->nrelocs > (header->size - header->relocs) / sizeof(uint64_t) ||
+	    header->root % SNAP_ALIGN || header->root < sizeof *header ||
+	    header->root > header->size - sizeof(Node) ||
+	    (header->lines && (header->lines % SNAP_ALIGN || header->lines < sizeof *header ||
+	    header->lines > header->size - sizeof(LineTable))) ||
+	    !snap_relocate(base, header) ||
+	    ((Node *)(base + header->root))->type != AST_BLOCK || !snap_lines_valid(base, header)) {
+		if (base != MAP_FAILED) {
+			munmap(base, st.st_size);
+		}
+		snprintf(error->message, sizeof error->message, "cannot load snapshot %s", path);
+		error->line = 0;
+		error->column = 0;
+		return NULL;
+	}
+	LangProgram *program = malloc(sizeof *program);
+	program->block = (Node *)(base + header->root);
+	program->arena = NULL;
+	program->strings = NULL;
+	program->lines = header->lines ? (LineTable *)(base + header->lines) : NULL;
+	program->image = base;
+	program->imagesize = header->size;
+	return program;
+}
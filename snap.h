@@ -0,0 +1,6 @@
+#ifndef SNAP_H
+#define SNAP_H 1
+#include "lang.h"
+int lang_program_save(const LangProgram *program, const char *path, LangError *error);
+LangProgram *lang_program_load(const char *path, LangError *error);
+#endif
@@ -0,0 +1,73 @@
+#include "ast.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+Stats stats;
+
+static const char *phase_names[] = {"load", "lex", "parse", "pure", "types", "opt"};
+static const char *subsystem_names[] = {"arena", "ast", "lexer", "list", "parser"};
+static const char *node_names[] = {
+	"array", "assignment", "block", "bool", "boolean", "break", "call",
+	"continue", "decl", "func", "id", "if", "index", "join", "not", "logOp",
+	"num", "print", "return", "spawn", "str", "term", "while"
+};
+
+long
+stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void
+stats_token(const char *symbol)
+{
+	int i;
+	for (i = 0; i < stats.ntokens; i++) {
+		if (!strcmp(stats.tokens[i].symbol, symbol)) {
+			stats.tokens[i].count++;
+			return;
+		}
+	}
+	if (stats.ntokens < (int)(sizeof stats.tokens / sizeof *stats.tokens)) {
+		stats.tokens[stats.ntokens].symbol = symbol;
+		stats.tokens[stats.ntokens].count = 1;
+		stats.ntokens++;
+	}
+}
+
+void
+stats_malloc(StatsSubsystem subsystem, size_t size)
+{
+	stats.mallocs[subsystem]++;
+	stats.bytes[subsystem] += size;
+}
+
+void
+stats_print(FILE *f)
+{
+	int i;
+	fprintf(f, "{\"phases\":{");
+	for (i = 0; i < STATS_PHASES; i++) {
+		fprintf(f, "%s\"%s\":%ld", i ? "," : "", phase_names[i], stats.ns[i]);
+	}
+	fprintf(f, "},\"tokens\":{");
+	for (i = 0; i < stats.ntokens; i++) {
+		fprintf(f, "%s\"%s\":%ld", i ? "," : "", stats.tokens[i].symbol, stats.tokens[i].count);
+	}
+	fprintf(f, "},\"nodes\":{");
+	for (i = 0; i <= AST_WHILE_STATEMENT; i++) {
+		fprintf(f, "%s\"%s\":%ld", i ? "," : "", node_names[i], stats.nodes[i]);
+	}
+	fprintf(f, "},\"mallocs\":{");
+	for (i = 0; i < STATS_SUBSYSTEMS; i++) {
+		fprintf(f, "%s\"%s\":{\"count\":%ld,\"bytes\":%ld}", i ? "," : "",
+		    subsystem_names[i], stats.mallocs[i], stats.bytes[i]);
+	}
+	fprintf(f, "},\"hashcons\":{\"lookups\":%ld,\"hits\":%ld}}\n",
+	    stats.conslookups, stats.conshits);
+}
@@ -0,0 +1,73 @@
+#ifndef STATS_H
+#define STATS_H 1
+#include "arena.h"
+#include "ast.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum stats_phase {
+	STATS_LOAD,
+	STATS_LEX,
+	STATS_PARSE,
+	STATS_PURE,
+	STATS_TYPES,
+	STATS_OPT,
+	STATS_PHASES
+} StatsPhase;
+
+typedef enum stats_subsystem {
+	STATS_ARENA,
+	STATS_AST,
+	STATS_LEXER,
+	STATS_LIST,
+	STATS_PARSER,
+	STATS_SUBSYSTEMS
+} StatsSubsystem;
+
+typedef struct {
+	const char *symbol;
+	long count;
+} StatsToken;
+
+typedef struct {
+	int enabled;
+	long ns[STATS_PHASES];
+	StatsToken tokens[64];
+	int ntokens;
+	long nodes[AST_WHILE_STATEMENT + 1];
+	long mallocs[STATS_SUBSYSTEMS];
+	long bytes[STATS_SUBSYSTEMS];
+	long conslookups, conshits;
+} Stats;
+
+extern Stats stats;
+
+long stats_now(void);
+void stats_token(const char *symbol);
+void stats_malloc(StatsSubsystem subsystem, size_t size);
+void stats_print(FILE *f);
+
+#ifdef NSTATS
+#define STATS_START() 0
+#define STATS_STOP(phase, start) ((void)(start))
+#define STATS_TOKEN(symbol) ((void)0)
+#define STATS_NODE(type) ((void)0)
+#define STATS_CONS(hit) ((void)0)
+#define STATS_MALLOC(subsystem, size) malloc(size)
+#define STATS_ALLOC(subsystem, size) arena_malloc(size)
+#else
+#define STATS_START() (stats.enabled ? stats_now() : 0)
+#define STATS_STOP(phase, start) \
+	do { if (stats.enabled) stats.ns[phase] += stats_now() - (start); } while (0)
+#define STATS_TOKEN(symbol) \
+	do { if (stats.enabled) stats_token(symbol); } while (0)
+#define STATS_NODE(type) \
+	do { if (stats.enabled) stats.nodes[type]++; } while (0)
+#define STATS_CONS(hit) \
+	do { if (stats.enabled) { stats.conslookups++; stats.conshits += (hit); } } while (0)
+#define STATS_MALLOC(subsystem, size) \
+	((stats.enabled ? stats_malloc(subsystem, size) : (void)0), malloc(size))
+#define STATS_ALLOC(subsystem, size) \
+	((stats.enabled ? stats_malloc(subsystem, size) : (void)0), arena_malloc(size))
+#endif
+#endif
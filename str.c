@@ -0,0 +1,68 @@
+#include "str.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * String builder. A String caches its length and grows its buffer by
+ * doubling, so a sequence of appends costs time linear in the final
+ * length instead of copying the whole prefix on every append. The
+ * buffer is always NUL-terminated once anything has been appended;
+ * start from {0, 0, NULL} and hand s to the caller when done.
+ */
+
+static void
+string_reserve(String *str, int len)
+{
+	if (str->len + len + 1 > str->cap) {
+		while (str->len + len + 1 > str->cap) {
+			str->cap = str->cap ? str->cap * 2 : 64;
+		}
+		str->s = realloc(str->s, str->cap);
+	}
+}
+
+void
+string_append(String *str, const char *s)
+{
+	int len = strlen(s);
+	string_reserve(str, len);
+	memcpy(str->s + str->len, s, len + 1);
+	str->len += len;
+}
+
+static void
+string_vappendf(String *str, const char *fmt, va_list args)
+{
+	va_list copy;
+	string_reserve(str, 0);
+	va_copy(copy, args);
+	int written = vsnprintf(str->s + str->len, str->cap - str->len, fmt, copy);
+	va_end(copy);
+	if (written >= str->cap - str->len) {
+		string_reserve(str, written);
+		vsnprintf(str->s + str->len, str->cap - str->len, fmt, args);
+	}
+	str->len += written;
+}
+
+void
+string_appendf(String *str, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	string_vappendf(str, fmt, args);
+	va_end(args);
+}
+
+const char *
+sprintf_alloc(const char *fmt, ...)
+{
+	String str = {0, 0, NULL};
+	va_list args;
+	va_start(args, fmt);
+	string_vappendf(&str, fmt, args);
+	va_end(args);
+	return str.s;
+}
@@ -0,0 +1,11 @@
+#ifndef STR_H
+#define STR_H 1
+typedef struct string {
+  int len, cap;
+  char *s;
+} String;
+
+const char *sprintf_alloc(const char *fmt, ...);
+void string_append(String *str, const char *s);
+void string_appendf(String *str, const char *fmt, ...);
+#endif
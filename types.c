@@ -0,0 +1,384 @@
+#include "ast.h"
+#include "builtin.h"
+#include "list.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Flow-insensitive type inference. Each variable gets the join of every
+ * value stored into it and each parameter the join of every argument
+ * passed at a call site, iterated until nothing changes. Functions and
+ * while loops that only ever see integers (and the booleans produced by
+ * comparing them) are flagged as candidates for unboxed specialization.
+ * Arrays only ever hold integers, so indexing one gives an integer.
+ * A call to a builtin with the wrong number of arguments is reported
+ * through the lexer that read the program, at the call's offset.
+ */
+
+typedef struct {
+	const char *name;
+	Type type;
+} Variable;
+
+typedef struct {
+	FunctionStatement *fs;
+	Variable *vars;
+	int len, cap;
+	Type ret;
+} Signature;
+
+typedef struct {
+	Signature *sigs;
+	int len, cap;
+	int changed;
+	Lexer *lexer;
+	CallExpression *error;
+	int count;
+} Inference;
+
+static void type_block(Inference *inf, Signature *sig, Node *node, int *integer);
+static Type type_expression(Inference *inf, Signature *sig, Node *node, int *integer);
+
+static const char *type_names[] = {"none", "int", "bool", "string", "array", "any"};
+
+static Type
+type_join(Type a, Type b)
+{
+	if (a == TYPE_NONE) {
+		return b;
+	}
+	if (b == TYPE_NONE || a == b) {
+		return a;
+	}
+	return TYPE_ANY;
+}
+
+static Variable *
+signature_lookup(Signature *sig, const char *name)
+{
+	int i;
+	for (i = 0; i < sig->len; i++) {
+		if (!strcmp(sig->vars[i].name, name)) {
+			return &sig->vars[i];
+		}
+	}
+	return NULL;
+}
+
+static void
+signature_store(Inference *inf, Signature *sig, const char *name, Type type)
+{
+	Variable *v = signature_lookup(sig, name);
+	if (v == NULL) {
+		if (sig->len == sig->cap) {
+			sig->cap = sig->cap ? sig->cap * 2 : 8;
+			sig->vars = realloc(sig->vars, sig->cap * sizeof *sig->vars);
+		}
+		v = &sig->vars[sig->len++];
+		v->name = name;
+		v->type = TYPE_NONE;
+		inf->changed = 1;
+	}
+	Type joined = type_join(v->type, type);
+	if (joined != v->type) {
+		v->type = joined;
+		inf->changed = 1;
+	}
+}
+
+static Signature *
+inference_add(Inference *inf, FunctionStatement *fs)
+{
+	if (inf->len == inf->cap) {
+		inf->cap = inf->cap ? inf->cap * 2 : 16;
+		inf->sigs = realloc(inf->sigs, inf->cap * sizeof *inf->sigs);
+	}
+	Signature *sig = &inf->sigs[inf->len++];
+	sig->fs = fs;
+	sig->vars = NULL;
+	sig->len = 0;
+	sig->cap = 0;
+	sig->ret = TYPE_NONE;
+	return sig;
+}
+
+static Signature *
+inference_lookup(Inference *inf, const char *name)
+{
+	int i;
+	for (i = 0; i < inf->len; i++) {
+		if (inf->sigs[i].fs && !strcmp(inf->sigs[i].fs->name, name)) {
+			return &inf->sigs[i];
+		}
+	}
+	return NULL;
+}
+
+static void
+inference_collect(Inference *inf, Node *node)
+{
+	ListNode *n;
+	switch (node->type) {
+	case AST_BLOCK:
+		for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+			if (n->value) {
+				inference_collect(inf, (Node *)n->value);
+			}
+		}
+		break;
+	case AST_FUNCTION_STATEMENT: {
+		FunctionStatement *fs = (FunctionStatement *)node->value;
+		Signature *sig = inference_add(inf, fs);
+		for (n = fs->parameters->head; n; n = n->next) {
+			signature_store(inf, sig, n->value, TYPE_NONE);
+		}
+		if (fs->block) {
+			inference_collect(inf, fs->block);
+		}
+		break;
+	}
+	case AST_IF_STATEMENT:
+		inference_collect(inf, ((IfStatement *)node->value)->block);
+		break;
+	case AST_WHILE_STATEMENT:
+		inference_collect(inf, ((WhileStatement *)node->value)->block);
+		break;
+	default:
+		break;
+	}
+}
+
+static Type
+type_arithmetic(const char *operator, Type left, Type right)
+{
+	if (left == TYPE_INT && right == TYPE_INT) {
+		return TYPE_INT;
+	}
+	if (!strcmp(operator, "+") && (left == TYPE_STRING || right == TYPE_STRING)) {
+		return TYPE_STRING;
+	}
+	if (left == TYPE_NONE || right == TYPE_NONE) {
+		return TYPE_NONE;
+	}
+	return TYPE_ANY;
+}
+
+static Type
+type_call(Inference *inf, Signature *sig, CallExpression *ce, int *integer)
+{
+	Signature *callee = inference_lookup(inf, ce->name);
+	const Builtin *builtin = callee ? NULL : builtin_lookup(ce->name);
+	ListNode *n, *p;
+	int count = 0;
+	p = callee ? callee->fs->parameters->head : NULL;
+	for (n = ce->arguments->head; n; n = n->next, count++) {
+		Type t = type_expression(inf, sig, (Node *)n->value, integer);
+		if (p) {
+			signature_store(inf, callee, p->value, t);
+			p = p->next;
+		}
+	}
+	if (builtin) {
+		if (count != builtin->arity && inf->error == NULL) {
+			/* raised by type_analyze once the signatures are freed */
+			inf->error = ce;
+			inf->count = count;
+		}
+		return builtin->type;
+	}
+	return callee ? callee->ret : TYPE_ANY;
+}
+
+static Type
+type_expression(Inference *inf, Signature *sig, Node *node, int *integer)
+{
+	Type t;
+	ListNode *n;
+	switch (node->type) {
+	case AST_ARRAY_LITERAL:
+		for (n = ((ArrayLiteral *)node->value)->elements->head; n; n = n->next) {
+			type_expression(inf, sig, (Node *)n->value, integer);
+		}
+		t = TYPE_ARRAY;
+		break;
+	case AST_BOOLEAN_EXPRESSION: {
+		BooleanExpression *be = (BooleanExpression *)node->value;
+		type_expression(inf, sig, be->left, integer);
+		type_expression(inf, sig, be->right, integer);
+		t = TYPE_BOOL;
+		break;
+	}
+	case AST_LOGICAL_OPERAND: {
+		LogicalOperand *lo = (LogicalOperand *)node->value;
+		Type left = type_expression(inf, sig, lo->left, integer);
+		t = type_arithmetic(lo->operator, left, type_expression(inf, sig, lo->right, integer));
+		break;
+	}
+	case AST_TERM: {
+		Term *tm = (Term *)node->value;
+		Type left = type_expression(inf, sig, tm->left, integer);
+		t = type_arithmetic(tm->operator, left, type_expression(inf, sig, tm->right, integer));
+		break;
+	}
+	case AST_INDEX_EXPRESSION: {
+		IndexExpression *ie = (IndexExpression *)node->value;
+		Type array = type_expression(inf, sig, ie->array, integer);
+		type_expression(inf, sig, ie->index, integer);
+		t = array == TYPE_ARRAY ? TYPE_INT : array == TYPE_NONE ? TYPE_NONE : TYPE_ANY;
+		break;
+	}
+	case AST_LOGICAL_NOT_EXPRESSION:
+		type_expression(inf, sig, ((LogicalNotExpression *)node->value)->booleanExpression, integer);
+		t = TYPE_BOOL;
+		break;
+	case AST_CALL_EXPRESSION:
+		t = type_call(inf, sig, (CallExpression *)node->value, integer);
+		break;
+	case AST_IDENTIFIER: {
+		Variable *v = signature_lookup(sig, ((Identifier *)node->value)->value);
+		t = v ? v->type : TYPE_ANY;
+		break;
+	}
+	case AST_NUMBER_LITERAL:
+		t = TYPE_INT;
+		break;
+	case AST_BOOLEAN_LITERAL:
+		t = TYPE_BOOL;
+		break;
+	case AST_STRING_LITERAL:
+		t = TYPE_STRING;
+		break;
+	default:
+		t = TYPE_ANY;
+		break;
+	}
+	if (t != TYPE_INT && t != TYPE_BOOL) {
+		*integer = 0;
+	}
+	return t;
+}
+
+static void
+type_statement(Inference *inf, Signature *sig, Node *node, int *integer)
+{
+	if (node == NULL) {
+		return;
+	}
+	switch (node->type) {
+	case AST_ASSIGNMENT_STATEMENT: {
+		AssignmentStatement *as = (AssignmentStatement *)node->value;
+		signature_store(inf, sig, as->id, type_expression(inf, sig, as->expression, integer));
+		break;
+	}
+	case AST_DECLARATION_STATEMENT: {
+		DeclarationStatement *ds = (DeclarationStatement *)node->value;
+		signature_store(inf, sig, ds->id, type_expression(inf, sig, ds->expression, integer));
+		break;
+	}
+	case AST_IF_STATEMENT: {
+		IfStatement *is = (IfStatement *)node->value;
+		type_expression(inf, sig, is->booleanExpression, integer);
+		type_block(inf, sig, is->block, integer);
+		break;
+	}
+	case AST_WHILE_STATEMENT: {
+		WhileStatement *ws = (WhileStatement *)node->value;
+		int loop = 1;
+		type_expression(inf, sig, ws->booleanExpression, &loop);
+		type_block(inf, sig, ws->block, &loop);
+		ws->integer = loop;
+		*integer = *integer && loop;
+		break;
+	}
+	case AST_PRINT_STATEMENT:
+		type_expression(inf, sig, ((PrintStatement *)node->value)->expression, integer);
+		break;
+	case AST_RETURN_STATEMENT: {
+		ReturnStatement *rs = (ReturnStatement *)node->value;
+		if (rs->expression) {
+			Type t = type_join(sig->ret, type_expression(inf, sig, rs->expression, integer));
+			if (t != sig->ret) {
+				sig->ret = t;
+				inf->changed = 1;
+			}
+		}
+		break;
+	}
+	case AST_CALL_EXPRESSION:
+		type_call(inf, sig, (CallExpression *)node->value, integer);
+		break;
+	case AST_SPAWN_STATEMENT:
+		type_call(inf, sig, (CallExpression *)((SpawnStatement *)node->value)->callExpression->value, integer);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+type_block(Inference *inf, Signature *sig, Node *node, int *integer)
+{
+	ListNode *n;
+	for (n = ((Block *)node->value)->statements->head; n; n = n->next) {
+		type_statement(inf, sig, (Node *)n->value, integer);
+	}
+}
+
+static int
+signature_integer(Signature *sig)
+{
+	int i;
+	for (i = 0; i < sig->len; i++) {
+		if (sig->vars[i].type != TYPE_INT && sig->vars[i].type != TYPE_BOOL) {
+			return 0;
+		}
+	}
+	return sig->ret == TYPE_INT || sig->ret == TYPE_NONE;
+}
+
+void
+type_analyze(Node *block, Lexer *lexer)
+{
+	Inference inf = {NULL, 0, 0, 0, lexer, NULL, 0};
+	Signature *top;
+	int i, integer;
+	inference_add(&inf, NULL);
+	inference_collect(&inf, block);
+	top = &inf.sigs[0];
+	do {
+		inf.changed = 0;
+		integer = 1;
+		type_block(&inf, top, block, &integer);
+		for (i = 1; i < inf.len; i++) {
+			if (inf.sigs[i].fs->block == NULL) {
+				continue;
+			}
+			integer = 1;
+			type_block(&inf, &inf.sigs[i], inf.sigs[i].fs->block, &integer);
+			inf.sigs[i].fs->integer = integer && signature_integer(&inf.sigs[i]);
+		}
+	} while (inf.changed);
+	const char *typedebug = getenv("TYPEDEBUG");
+	for (i = 1; i < inf.len; i++) {
+		Signature *sig = &inf.sigs[i];
+		if (typedebug && strcmp(typedebug, "")) {
+			ListNode *n;
+			fprintf(stderr, "%s %s(", sig->fs->integer ? "integer" : "generic", sig->fs->name);
+			for (n = sig->fs->parameters->head; n; n = n->next) {
+				fprintf(stderr, "%s%s", n == sig->fs->parameters->head ? "" : ", ",
+				    type_names[signature_lookup(sig, n->value)->type]);
+			}
+			fprintf(stderr, ") %s\n", type_names[sig->ret]);
+		}
+		free(sig->vars);
+	}
+	free(top->vars);
+	free(inf.sigs);
+	if (inf.error) {
+		const Builtin *builtin = builtin_lookup(inf.error->name);
+		lexer_error(lexer, inf.error->offset, "'%s' takes %d argument%s, got %d", inf.error->name,
+		    builtin->arity, builtin->arity == 1 ? "" : "s", inf.count);
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef TYPES_H
+#define TYPES_H 1
+#include "ast.h"
+#include "lex.h"
+typedef enum type {
+	TYPE_NONE,
+	TYPE_INT,
+	TYPE_BOOL,
+	TYPE_STRING,
+	TYPE_ARRAY,
+	TYPE_ANY
+} Type;
+void type_analyze(Node *block, Lexer *lexer);
+#endif